@@ -0,0 +1,116 @@
+// Compact binary chat protocol, negotiated per connection.
+//
+// A client asks for it by sending BINARY_HELLO as its very first frame. A server that
+// speaks it switches the connection over: every later frame in both directions is binary,
+// starting with the client's username and the "Enter password: " prompt (a TEXT frame,
+// whose leading zero byte tells the client it was accepted; an older server would have
+// taken the hello for a username and sends the prompt as plain text). There is no separate
+// acknowledgement, which would sit behind the username prompt waiting for a delayed ACK. Frames
+// keep the 4-byte length prefix of framing.h; the payload starts with a one-byte opcode,
+// followed by a fixed number of 4-byte big-endian IDs for that opcode, then the body:
+//
+//   TEXT            op                  text line (prompts, notices, errors, text commands)
+//   BROADCAST       op                  message          client -> server
+//   MSG             op  user            message          client -> server
+//   GROUP_MSG       op  group           message          client -> server
+//   USER_NAME       op  user            username         server -> client
+//   GROUP_NAME      op  group           group name       server -> client
+//   BROADCAST_FROM  op  sender          message          server -> client
+//   MSG_FROM        op  sender          message          server -> client
+//   GROUP_MSG_FROM  op  sender group    message          server -> client
+//
+// User and group IDs are the server's interned IDs (never 0). Before the first frame
+// that refers to an ID a connection hasn't seen yet, the server sends its USER_NAME or
+// GROUP_NAME, so a delivery carries no names and the client keeps the ID -> name table.
+// Anything without an opcode of its own is sent as a TEXT frame holding the text command.
+
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+#include "framing.h"
+
+#define BINARY_HELLO std::string_view("\0CHAT-BINARY/1", 14) // Starts with a NUL, so no username can clash
+
+enum class BinaryOp : uint8_t {
+    TEXT = 0,
+    BROADCAST = 1,
+    MSG = 2,
+    GROUP_MSG = 3,
+    USER_NAME = 16,
+    GROUP_NAME = 17,
+    BROADCAST_FROM = 18,
+    MSG_FROM = 19,
+    GROUP_MSG_FROM = 20,
+};
+
+// Number of IDs after the opcode, -1 for unknown opcodes
+inline int binary_id_count(BinaryOp op) {
+    switch (op) {
+    case BinaryOp::TEXT:
+    case BinaryOp::BROADCAST:      return 0;
+    case BinaryOp::MSG:
+    case BinaryOp::GROUP_MSG:
+    case BinaryOp::USER_NAME:
+    case BinaryOp::GROUP_NAME:
+    case BinaryOp::BROADCAST_FROM:
+    case BinaryOp::MSG_FROM:       return 1;
+    case BinaryOp::GROUP_MSG_FROM: return 2;
+    }
+    return -1;
+}
+
+struct BinaryFrame {
+    BinaryOp op = BinaryOp::TEXT;
+    uint32_t ids[2] = {0, 0};
+    std::string_view body; // Points into the frame
+};
+
+// Split a frame's payload into opcode, IDs and body. False for an unknown opcode or a short header.
+inline bool parse_binary(std::string_view frame, BinaryFrame& out) {
+    if (frame.empty()) return false;
+    out.op = BinaryOp(uint8_t(frame[0]));
+    int ids = binary_id_count(out.op);
+    if (ids < 0 || frame.size() < size_t(1 + 4 * ids)) return false;
+
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(frame.data()) + 1;
+    for (int i = 0; i < ids; ++i, p += 4) {
+        out.ids[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+    out.body = frame.substr(1 + 4 * ids);
+    return true;
+}
+
+// Append one binary frame (length prefix included) to out. The body is the concatenation of parts,
+// cut off where the frame would go over MAX_FRAME_SIZE.
+inline void append_binary(std::string& out, BinaryOp op, uint32_t id0, uint32_t id1, std::initializer_list<std::string_view> parts) {
+    int ids = binary_id_count(op);
+    size_t len = std::min<size_t>(1 + 4 * ids + parts_size(parts), MAX_FRAME_SIZE);
+
+    char header[FRAME_HEADER_SIZE + 9] = {
+        char((len >> 24) & 0xff), char((len >> 16) & 0xff), char((len >> 8) & 0xff), char(len & 0xff), char(op),
+    };
+    uint32_t values[2] = {id0, id1};
+    for (int i = 0; i < ids; ++i) {
+        char* p = header + FRAME_HEADER_SIZE + 1 + 4 * i;
+        p[0] = char((values[i] >> 24) & 0xff);
+        p[1] = char((values[i] >> 16) & 0xff);
+        p[2] = char((values[i] >> 8) & 0xff);
+        p[3] = char(values[i] & 0xff);
+    }
+    out.append(header, FRAME_HEADER_SIZE + 1 + 4 * ids);
+    append_parts(out, parts, len - 1 - 4 * ids);
+}
+
+inline std::string encode_binary(BinaryOp op, uint32_t id0, uint32_t id1, std::initializer_list<std::string_view> parts) {
+    std::string out;
+    append_binary(out, op, id0, id1, parts);
+    return out;
+}
+
+#endif // BINARY_PROTOCOL_H
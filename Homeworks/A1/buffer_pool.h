@@ -0,0 +1,93 @@
+// Pool of receive buffers for per-connection frame readers.
+//
+// Buffers come in a few power-of-two size classes. Each class carves fixed-size buffers
+// out of large slabs and keeps released buffers on a free list, so connecting and
+// disconnecting recycles memory instead of going back to the allocator, and nothing is
+// zeroed. A connection holds one buffer of the smallest class and only moves up to a
+// bigger class while a large frame is being received. Occupancy per class is kept so
+// the memory used by receive buffers is visible at any time.
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define BUFFER_CLASSES 4
+#define BUFFER_SLAB_SIZE (256 * 1024)
+
+class BufferPool {
+public:
+    struct ClassStats {
+        size_t size;   // Bytes per buffer
+        size_t in_use; // Buffers held by connections
+        size_t free;   // Buffers cached on the free list
+    };
+
+    static constexpr size_t class_size(size_t c) {
+        constexpr size_t sizes[BUFFER_CLASSES] = {4 * 1024, 16 * 1024, 64 * 1024, 128 * 1024};
+        return sizes[c];
+    }
+
+    // Smallest class holding at least bytes, BUFFER_CLASSES if none does
+    static size_t class_for(size_t bytes) {
+        size_t c = 0;
+        while (c < BUFFER_CLASSES && class_size(c) < bytes) ++c;
+        return c;
+    }
+
+    static constexpr size_t largest() { return class_size(BUFFER_CLASSES - 1); }
+
+    char* acquire(size_t size_class) {
+        Class& cls = classes_[size_class];
+        std::lock_guard<std::mutex> lock(cls.mtx);
+        if (cls.free.empty()) {
+            // Carve a new slab into buffers of this class
+            size_t size = class_size(size_class);
+            size_t count = std::max<size_t>(1, BUFFER_SLAB_SIZE / size);
+            cls.slabs.push_back(std::make_unique<char[]>(size * count));
+            for (size_t i = 0; i < count; ++i) {
+                cls.free.push_back(cls.slabs.back().get() + i * size);
+            }
+        }
+        char* buffer = cls.free.back();
+        cls.free.pop_back();
+        ++cls.in_use;
+        return buffer;
+    }
+
+    void release(char* buffer, size_t size_class) {
+        Class& cls = classes_[size_class];
+        std::lock_guard<std::mutex> lock(cls.mtx);
+        cls.free.push_back(buffer);
+        --cls.in_use;
+    }
+
+    std::array<ClassStats, BUFFER_CLASSES> stats() const {
+        std::array<ClassStats, BUFFER_CLASSES> out;
+        for (size_t c = 0; c < BUFFER_CLASSES; ++c) {
+            std::lock_guard<std::mutex> lock(classes_[c].mtx);
+            out[c] = {class_size(c), classes_[c].in_use, classes_[c].free.size()};
+        }
+        return out;
+    }
+
+private:
+    struct Class {
+        mutable std::mutex mtx;
+        std::vector<std::unique_ptr<char[]>> slabs; // Never returned, buffers are recycled
+        std::vector<char*> free;
+        size_t in_use = 0;
+    };
+
+    std::array<Class, BUFFER_CLASSES> classes_;
+};
+
+// Process-wide pool, used by every FrameReader
+inline BufferPool recv_buffers;
+
+#endif // BUFFER_POOL_H
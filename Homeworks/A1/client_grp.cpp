@@ -2,46 +2,366 @@
 
 #include <iostream>
 #include <string>
-#include <thread>
-#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <limits>
 #include <cstring>
 #include <cstdlib>
+#include <cerrno>
+#include <csignal>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <arpa/inet.h>
 
-#define BUFFER_SIZE 1024
+#include "binary_protocol.h"
+#include "command.h"
+#include "framing.h"
 
-std::mutex cout_mutex;
-//
+#define BUFFER_SIZE 4096
+#define TICK_MS 16     // The server socket is read, and its messages printed, at most once per tick
+#define REPORT_MS 1000 // Headless mode: how often to print the message rate
+#define MAX_PENDING_OUTPUT (1 << 20) // Stop reading the keyboard while this much is waiting for the server
 
-void handle_server_messages(int server_socket) {
+// Binary protocol (--binary): IDs the server has named so far, both ways
+bool binary = false;
+std::unordered_map<uint32_t, std::string> user_names, group_names;
+std::unordered_map<std::string, uint32_t> user_ids, group_ids;
+
+// Headless mode (--headless): count the messages from the server instead of printing them
+bool headless = false;
+volatile sig_atomic_t interrupted = 0;
+
+uint64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// What the user types, read straight from fd 0. Going through std::cin would let stdio
+// buffer lines that poll() then never reports.
+struct InputReader {
+    std::string buffer;
+    bool eof = false;
+
+    // Read whatever is available, false at end of input
+    bool fill() {
+        char chunk[BUFFER_SIZE];
+        ssize_t n = read(STDIN_FILENO, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) return true;
+        if (n <= 0) {
+            eof = true;
+            return false;
+        }
+        buffer.append(chunk, n);
+        return true;
+    }
+
+    // Take the next complete line (at end of input, whatever is left)
+    bool next(std::string& line) {
+        size_t end = buffer.find('\n');
+        if (end == std::string::npos) {
+            if (!eof || buffer.empty()) return false;
+            end = buffer.size();
+        }
+        line.assign(buffer, 0, end);
+        buffer.erase(0, end + 1);
+        return true;
+    }
+
+    // Block until a line is typed, empty at end of input
+    std::string read_line() {
+        std::string line;
+        while (!next(line)) {
+            if (!fill() && !next(line)) return "";
+        }
+        return line;
+    }
+};
+
+// Frames for the server that the socket hasn't taken yet. Once the event loop makes the
+// socket non-blocking, a send can stop short when the server falls behind; the rest waits
+// here and goes out when poll() reports the socket writable, so no frame is cut in half.
+struct ServerOutput {
+    std::string buffer;
+    size_t sent = 0; // Bytes of buffer already written
+
+    bool empty() const { return sent == buffer.size(); }
+    size_t pending() const { return buffer.size() - sent; }
+
+    // Write as much as the socket takes, false once the connection is gone
+    bool flush(int server_socket) {
+        while (!empty()) {
+            ssize_t n = send(server_socket, buffer.data() + sent, pending(), MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n <= 0) return false;
+            sent += n;
+        }
+        if (empty()) {
+            buffer.clear();
+            sent = 0;
+        }
+        else if (sent >= buffer.size() / 2) {
+            buffer.erase(0, sent);
+            sent = 0;
+        }
+        return true;
+    }
+};
+
+ServerOutput to_server;
+
+// Block until the next whole frame from the server is available, false on disconnect
+bool receive_frame(int server_socket, FrameReader& reader, std::string& message) {
     char buffer[BUFFER_SIZE];
-    while (true) {
-        memset(buffer, 0, BUFFER_SIZE);
+    std::string_view frame;
+    while (!reader.next(frame)) {
+        if (reader.bad()) return false;
         int bytes_received = recv(server_socket, buffer, BUFFER_SIZE, 0);
-        if (bytes_received <= 0) {
-            std::lock_guard<std::mutex> lock(cout_mutex);
-            std::cout << "Disconnected from server." << std::endl;
-            close(server_socket);
-            exit(0);
+        if (bytes_received <= 0) return false;
+        reader.append(buffer, bytes_received);
+    }
+    message.assign(frame.data(), frame.size());
+    return true;
+}
+
+// Send one message to the server as a single frame. The sends below queue the frame and
+// write what the socket takes; returns false once the connection is gone.
+bool send_frame(int server_socket, const std::string& message) {
+    append_frame(to_server.buffer, message);
+    return to_server.flush(server_socket);
+}
+
+// Send a line as it is (a TEXT frame in binary mode)
+bool send_text(int server_socket, const std::string& message) {
+    if (!binary) {
+        return send_frame(server_socket, message);
+    }
+    append_binary(to_server.buffer, BinaryOp::TEXT, 0, 0, {message});
+    return to_server.flush(server_socket);
+}
+
+uint32_t find_id(const std::unordered_map<std::string, uint32_t>& ids, std::string_view name) {
+    auto it = ids.find(std::string(name));
+    return it == ids.end() ? 0 : it->second;
+}
+
+// Send a command typed by the user. In binary mode messages go out with an opcode once the
+// server has told us the recipient's or group's ID, anything else as a text command.
+bool send_command(int server_socket, const std::string& message) {
+    Command cmd = parse_command(message);
+    if (!binary || cmd.body.empty()) {
+        return send_text(server_socket, message);
+    }
+
+    std::string frame;
+    uint32_t id = 0;
+    if (cmd.type == CommandType::BROADCAST) {
+        append_binary(frame, BinaryOp::BROADCAST, 0, 0, {cmd.body});
+    }
+    else if (cmd.type == CommandType::MSG && (id = find_id(user_ids, cmd.arg))) {
+        append_binary(frame, BinaryOp::MSG, id, 0, {cmd.body});
+    }
+    else if (cmd.type == CommandType::GROUP_MSG && (id = find_id(group_ids, cmd.arg))) {
+        append_binary(frame, BinaryOp::GROUP_MSG, id, 0, {cmd.body});
+    }
+    if (frame.empty()) {
+        return send_text(server_socket, message);
+    }
+    to_server.buffer += frame;
+    return to_server.flush(server_socket);
+}
+
+// Append the line to print for a frame from the server to out, false for frames that print nothing
+bool append_line(std::string_view message, std::string& out) {
+    BinaryFrame frame;
+    if (!binary) {
+        out.append(message);
+        return true;
+    }
+    if (!parse_binary(message, frame)) return false;
+
+    switch (frame.op) {
+    case BinaryOp::TEXT:
+        out.append(frame.body);
+        return true;
+    case BinaryOp::USER_NAME: {
+        std::string name(frame.body);
+        user_names[frame.ids[0]] = name;
+        user_ids[name] = frame.ids[0];
+        return false;
+    }
+    case BinaryOp::GROUP_NAME: {
+        std::string name(frame.body);
+        group_names[frame.ids[0]] = name;
+        group_ids[name] = frame.ids[0];
+        return false;
+    }
+    case BinaryOp::BROADCAST_FROM:
+        out.append("broadcast from ").append(user_names[frame.ids[0]]).append(": ").append(frame.body);
+        return true;
+    case BinaryOp::MSG_FROM:
+        out.append(user_names[frame.ids[0]]).append(": ").append(frame.body);
+        return true;
+    case BinaryOp::GROUP_MSG_FROM:
+        out.append("[Group ").append(group_names[frame.ids[1]]).append("] ");
+        out.append(user_names[frame.ids[0]]).append(": ").append(frame.body);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Next frame that prints something
+bool receive_line(int server_socket, FrameReader& reader, std::string& line) {
+    std::string message;
+    while (receive_frame(server_socket, reader, message)) {
+        line.clear();
+        if (append_line(message, line)) return true;
+    }
+    return false;
+}
+
+// Write all of out to the terminal with as few write() calls as it takes
+void write_output(std::string& out) {
+    size_t written = 0;
+    while (written < out.size()) {
+        ssize_t n = write(STDOUT_FILENO, out.data() + written, out.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += n;
+    }
+    out.clear();
+}
+
+// Headless mode: messages received, reported once per REPORT_MS and at exit
+struct MessageCounter {
+    uint64_t messages = 0, bytes = 0;
+    uint64_t start = now_ms(), last_report = start, last_messages = 0;
+
+    uint64_t next_report() const { return last_report + REPORT_MS; }
+
+    void report(uint64_t now, std::string& out) {
+        if (messages != last_messages) {
+            uint64_t rate = (messages - last_messages) * 1000 / std::max<uint64_t>(1, now - last_report);
+            out += "Received " + std::to_string(messages) + " messages (" + std::to_string(rate) + "/s)\n";
         }
-        std::lock_guard<std::mutex> lock(cout_mutex);
-        std::cout << buffer << std::endl;
+        last_messages = messages;
+        last_report = now;
+    }
+
+    void summary(uint64_t now, std::string& out) {
+        double seconds = std::max<uint64_t>(1, now - start) / 1000.0;
+        std::ostringstream line;
+        line << "Received " << messages << " messages, " << bytes << " bytes in " << seconds << " s ("
+             << uint64_t(messages / seconds) << "/s)\n";
+        out += line.str();
     }
+};
+
+void on_interrupt(int) {
+    interrupted = 1;
 }
 
-int main() {
+// After login: one thread waits on the server socket and the keyboard. The socket is read
+// at most once per tick: everything it holds by then is converted and goes to the terminal
+// in one write, so a busy chat costs a few syscalls per tick instead of a flush per message.
+// When the chat is quiet the first message of a tick is shown as soon as it arrives.
+// Commands the socket can't take yet wait in to_server, flushed whenever it is writable.
+void run_event_loop(int server_socket, FrameReader& reader, InputReader& input) {
+    fcntl(server_socket, F_SETFL, fcntl(server_socket, F_GETFL) | O_NONBLOCK);
+
+    std::string output, line;
+    MessageCounter counter;
+    uint64_t last_read = 0;
+    bool connected = true, exiting = false;
+    pollfd fds[2] = {{server_socket, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+
+    // After /exit, keep going only until the queued commands have reached the server
+    while (connected && !(exiting && to_server.empty()) && !interrupted) {
+        // Leave the socket out of the poll set until the next tick starts, unless output is waiting
+        uint64_t now = now_ms();
+        uint64_t wake = std::numeric_limits<uint64_t>::max();
+        bool read_due = now >= last_read + TICK_MS;
+        fds[0].events = (read_due ? POLLIN : 0) | (to_server.empty() ? 0 : POLLOUT);
+        fds[0].fd = fds[0].events ? server_socket : -1;
+        if (!read_due) wake = last_read + TICK_MS;
+        if (headless) wake = std::min(wake, counter.next_report());
+        int timeout = wake == std::numeric_limits<uint64_t>::max() ? -1 : int(wake > now ? wake - now : 0);
+
+        // The keyboard waits while the server is this far behind
+        bool typing = !input.eof && !exiting && to_server.pending() < MAX_PENDING_OUTPUT;
+        int ready = poll(fds, typing ? 2 : 1, timeout);
+        if (ready < 0 && errno != EINTR) break;
+
+        if (ready > 0 && (fds[0].revents & POLLOUT) && !to_server.flush(server_socket)) {
+            connected = false;
+            break;
+        }
+
+        // Everything the server has sent since the last tick
+        if (ready > 0 && (fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+            last_read = now_ms();
+            while (true) {
+                size_t room;
+                char* area = reader.write_area(room);
+                ssize_t n = recv(server_socket, area, room, 0);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                if (n <= 0) {
+                    connected = false;
+                    break;
+                }
+                reader.commit(n);
+
+                std::string_view frame;
+                while (reader.next(frame)) {
+                    if (!headless) {
+                        if (append_line(frame, output)) output += '\n';
+                        continue;
+                    }
+                    line.clear();
+                    if (append_line(frame, line)) {
+                        ++counter.messages;
+                        counter.bytes += frame.size();
+                    }
+                }
+                if (reader.bad()) {
+                    connected = false;
+                    break;
+                }
+            }
+        }
+
+        // Commands typed since the last tick, and any held back while the server was behind
+        if (ready > 0 && typing && fds[1].revents) input.fill();
+        while (connected && !exiting && to_server.pending() < MAX_PENDING_OUTPUT && input.next(line)) {
+            if (line.empty()) continue;
+            connected = send_command(server_socket, line);
+            exiting = line == "/exit";
+        }
+
+        if (headless && now_ms() >= counter.next_report()) counter.report(now_ms(), output);
+        write_output(output);
+    }
+
+    if (headless) counter.summary(now_ms(), output);
+    if (!connected) output += "Disconnected from server.\n";
+    write_output(output);
+    close(server_socket);
+}
+
+int connect_to_server() {
     int client_socket;
     sockaddr_in server_address{};
 
     client_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (client_socket < 0) {
         std::cerr << "Error creating socket." << std::endl;
-        return 1;
+        exit(1);
     }
 
     
@@ -52,66 +372,82 @@ int main() {
 
     if (connect(client_socket, (sockaddr*)&server_address, sizeof(server_address)) < 0) {
         std::cerr << "Error connecting to server. " << std::endl;
-        return 1;
+        exit(1);
+    }
+    return client_socket;
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--binary") binary = true;
+        else if (arg == "--headless") headless = true;
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--binary] [--headless]" << std::endl;
+            return 1;
+        }
     }
+    if (headless) signal(SIGINT, on_interrupt); // Ctrl-C prints the totals
 
+    int client_socket = connect_to_server();
     std::cout << "Connected to the server." << std::endl;
 
     // Authentication
-    std::string username, password;
-    char buffer[BUFFER_SIZE];
+    std::string username, password, reply;
+    FrameReader reader; // Kept for the event loop so no buffered frame is lost
+    InputReader input;
 
-    memset(buffer, 0, BUFFER_SIZE);
-    recv(client_socket, buffer, BUFFER_SIZE, 0); // Receive the message "Enter the user name" for the server
+    if (binary) {
+        send_frame(client_socket, std::string(BINARY_HELLO));
+    }
+
+    receive_frame(client_socket, reader, reply); // Receive the message "Enter the user name" for the server
     // You should have a line like this in the server.cpp code: send_message(client_socket, "Enter username: ");
  
-    std::cout << buffer;
-    std::getline(std::cin, username);
-    send(client_socket, username.c_str(), username.size(), 0);
+    std::cout << reply << std::flush;
+    username = input.read_line();
+    send_text(client_socket, username);
 
-    memset(buffer, 0, BUFFER_SIZE);
-    recv(client_socket, buffer, BUFFER_SIZE, 0); // Receive the message "Enter the password" for the server
-    std::cout << buffer;
-    std::getline(std::cin, password);
-    send(client_socket, password.c_str(), password.size(), 0);
+    receive_frame(client_socket, reader, reply); // Receive the message "Enter the password" for the server
+    if (binary && (reply.empty() || reply[0] != char(BinaryOp::TEXT))) {
+        // A plain-text prompt: the server doesn't know the binary protocol and took the hello for
+        // a username, so start over in text mode
+        std::cerr << "Server does not support the binary protocol, using text." << std::endl;
+        close(client_socket);
+        binary = false;
+        client_socket = connect_to_server();
+        reader = FrameReader();
+        receive_frame(client_socket, reader, reply);
+        send_text(client_socket, username);
+        receive_frame(client_socket, reader, reply);
+    }
+    std::string prompt;
+    append_line(reply, prompt);
+    std::cout << prompt << std::flush;
+    password = input.read_line();
+    send_text(client_socket, password);
 
-    memset(buffer, 0, BUFFER_SIZE);
     // Depending on whether the authentication passes or not, receive the message "Authentication Failed" or "Welcome to the server"
-    recv(client_socket, buffer, BUFFER_SIZE, 0); 
-    std::cout << buffer << std::endl;
-
-    if (std::string(buffer).find("Authentication failed") != std::string::npos) {
+    if (!receive_line(client_socket, reader, reply)) {
+        std::cout << "Disconnected from server." << std::endl;
         close(client_socket);
         return 1;
     }
+    std::cout << reply << std::endl;
 
-    // Start thread for receiving messages from server
-    std::thread receive_thread(handle_server_messages, client_socket);
-    // We use detach because we want this thread to run in the background while the main thread continues running
-    receive_thread.detach();
-
-    // Send messages to the server
-    while (true) {
-        std::string message;
-        std::getline(std::cin, message);
-
-        if (message.empty()) continue;
-
-        send(client_socket, message.c_str(), message.size(), 0);
-
-        if (message == "/exit") {
-            close(client_socket);
-            break;
-        }
+    if (reply.find("Authentication failed") != std::string::npos) {
+        close(client_socket);
+        return 1;
     }
 
+    // Receive messages and send commands until /exit or the server goes away
+    run_event_loop(client_socket, reader, input);
     return 0;
 }
 
 
 
 
-
 /*
 create git repo
 git remote -v
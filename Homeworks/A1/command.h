@@ -0,0 +1,114 @@
+// Command parser for the chat protocol.
+//
+// A command frame is tokenized in place: the command name, its argument and the message
+// body come back as std::string_views into the receive buffer, so parsing allocates and
+// copies nothing. The command name is dispatched with a switch on its length followed by
+// a single comparison, instead of trying each known command in turn.
+//
+// The result matches what the server used to get from std::istringstream: tokens are
+// separated by any whitespace, and the message body is the rest of the line after the
+// command (and argument) with leading spaces, tabs and line breaks removed.
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+enum class CommandType { BROADCAST, MSG, CREATE_GROUP, JOIN_GROUP, LEAVE_GROUP, GROUP_MSG, HISTORY, EXIT, INVALID };
+
+#define NUM_COMMANDS 9
+
+struct Command {
+    CommandType type = CommandType::INVALID;
+    std::string_view arg;  // Recipient or group name, empty if missing
+    std::string_view body; // Message text (the count for /history), empty if missing
+    uint32_t id = 0;       // Interned ID of arg when the client sent one (binary protocol), else 0
+};
+
+// Name as typed by the user, "invalid" for unknown commands
+inline const char* command_name(CommandType type) {
+    switch (type) {
+    case CommandType::BROADCAST:    return "/broadcast";
+    case CommandType::MSG:          return "/msg";
+    case CommandType::CREATE_GROUP: return "/create_group";
+    case CommandType::JOIN_GROUP:   return "/join_group";
+    case CommandType::LEAVE_GROUP:  return "/leave_group";
+    case CommandType::GROUP_MSG:    return "/group_msg";
+    case CommandType::HISTORY:      return "/history";
+    case CommandType::EXIT:         return "/exit";
+    case CommandType::INVALID:      break;
+    }
+    return "invalid";
+}
+
+// Same set as isspace() in the "C" locale, which operator>> splits tokens on
+inline bool command_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// Every command name has a distinct length except /broadcast and /group_msg
+inline CommandType command_type(std::string_view name) {
+    switch (name.size()) {
+    case 4:  return name == "/msg" ? CommandType::MSG : CommandType::INVALID;
+    case 5:  return name == "/exit" ? CommandType::EXIT : CommandType::INVALID;
+    case 8:  return name == "/history" ? CommandType::HISTORY : CommandType::INVALID;
+    case 10:
+        if (name == "/broadcast") return CommandType::BROADCAST;
+        return name == "/group_msg" ? CommandType::GROUP_MSG : CommandType::INVALID;
+    case 11: return name == "/join_group" ? CommandType::JOIN_GROUP : CommandType::INVALID;
+    case 12: return name == "/leave_group" ? CommandType::LEAVE_GROUP : CommandType::INVALID;
+    case 13: return name == "/create_group" ? CommandType::CREATE_GROUP : CommandType::INVALID;
+    }
+    return CommandType::INVALID;
+}
+
+// Consume the next whitespace-separated token from text
+inline std::string_view next_token(std::string_view& text) {
+    size_t pos = 0;
+    while (pos < text.size() && command_space(text[pos])) ++pos;
+    size_t end = pos;
+    while (end < text.size() && !command_space(text[end])) ++end;
+    std::string_view token = text.substr(pos, end - pos);
+    text.remove_prefix(end);
+    return token;
+}
+
+// Like std::getline, the body ends at the first newline
+inline std::string_view rest_of_line(std::string_view text) {
+    text = text.substr(0, text.find('\n'));
+    size_t start = text.find_first_not_of(" \t\r\n");
+    return start == std::string_view::npos ? std::string_view() : text.substr(start);
+}
+
+inline Command parse_command(std::string_view text) {
+    Command cmd;
+    cmd.type = command_type(next_token(text));
+
+    switch (cmd.type) {
+    case CommandType::BROADCAST:
+        cmd.body = rest_of_line(text);
+        break;
+    case CommandType::MSG:
+    case CommandType::GROUP_MSG:
+        cmd.arg = next_token(text);
+        cmd.body = rest_of_line(text);
+        break;
+    case CommandType::CREATE_GROUP:
+    case CommandType::JOIN_GROUP:
+    case CommandType::LEAVE_GROUP:
+        cmd.arg = next_token(text);
+        break;
+    case CommandType::HISTORY:
+        cmd.arg = next_token(text);
+        cmd.body = next_token(text);
+        break;
+    case CommandType::EXIT:
+    case CommandType::INVALID:
+        break;
+    }
+    return cmd;
+}
+
+#endif // COMMAND_H
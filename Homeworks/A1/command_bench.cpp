@@ -0,0 +1,131 @@
+// Microbenchmark for the chat command parser.
+//
+// Parses the same mix of command frames with the in-place std::string_view parser
+// (command.h) and with the std::istringstream code the server used before, checks that
+// both agree on every frame, and reports commands parsed per second for each.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+
+#include "command.h"
+
+#define CORPUS_SIZE 4096
+
+
+
+// The previous parser: copy the frame, tokenize with a stream, compare against each command
+Command parse_stream(std::string_view frame, std::string& arg, std::string& body) {
+    std::string message(frame);
+    std::istringstream iss(message);
+    std::string command;
+    iss >> command;
+
+    Command cmd;
+    arg.clear();
+    body.clear();
+
+    if (command != "/broadcast" && command != "/msg" && command != "/create_group" &&
+        command != "/join_group" && command != "/leave_group" && command != "/group_msg" && command != "/history" &&
+        command != "/exit" ) {
+        return cmd;
+    }
+
+    if (command == "/broadcast") {
+        cmd.type = CommandType::BROADCAST;
+        std::getline(iss, body);
+        body.erase(0, body.find_first_not_of(" \t\r\n"));
+    }
+    else if (command == "/msg" || command == "/group_msg") {
+        cmd.type = command == "/msg" ? CommandType::MSG : CommandType::GROUP_MSG;
+        iss >> arg;
+        std::getline(iss, body);
+        body.erase(0, body.find_first_not_of(" \t\r\n"));
+    }
+    else if (command == "/create_group" || command == "/join_group" || command == "/leave_group") {
+        cmd.type = command == "/create_group" ? CommandType::CREATE_GROUP :
+                   command == "/join_group" ? CommandType::JOIN_GROUP : CommandType::LEAVE_GROUP;
+        iss >> arg;
+    }
+    else if (command == "/history") {
+        cmd.type = CommandType::HISTORY;
+        iss >> arg >> body;
+    }
+    else {
+        cmd.type = CommandType::EXIT;
+    }
+
+    cmd.arg = arg;
+    cmd.body = body;
+    return cmd;
+}
+
+// A mix shaped like chat traffic, plus malformed and edge-case frames
+std::vector<std::string> make_corpus(size_t size) {
+    const std::vector<std::string> fixed = {
+        "/broadcast", "/broadcast   ", "/msg bob", "/msg", "  /exit  ", "/exit now", "/create_group",
+        "/join_group\tteam", "/leave_group  team  extra", "/group_msg team", "/group_msg team\nhi",
+        "/msg bob \n hi", "/broadcast\r\n hi", "/history team 10", "/history team", "/history", "/nope x y",
+        "", "   ", "hello there", "/Broadcast hi",
+    };
+
+    std::mt19937 rng(425);
+    std::vector<std::string> corpus(fixed);
+    while (corpus.size() < size) {
+        std::string text(8 + rng() % 120, 'x');
+        switch (rng() % 10) {
+        case 0:  corpus.push_back("/broadcast " + text); break;
+        case 1:  corpus.push_back("/group_msg team" + std::to_string(rng() % 10) + " " + text); break;
+        case 2:  corpus.push_back("/join_group team" + std::to_string(rng() % 10)); break;
+        default: corpus.push_back("/msg user" + std::to_string(rng() % 1000) + " " + text); break;
+        }
+    }
+    return corpus;
+}
+
+template <typename F>
+double commands_per_second(const std::vector<std::string>& corpus, size_t rounds, F&& parse) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+        for (const std::string& frame : corpus) parse(frame);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return rounds * corpus.size() / elapsed.count();
+}
+
+int main(int argc, char* argv[]) {
+    size_t rounds = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 500;
+    std::vector<std::string> corpus = make_corpus(CORPUS_SIZE);
+
+    // Both parsers must agree before their speed means anything
+    std::string arg, body;
+    for (const std::string& frame : corpus) {
+        Command a = parse_command(frame);
+        Command b = parse_stream(frame, arg, body);
+        if (a.type != b.type || a.arg != b.arg || a.body != b.body) {
+            std::cerr << "Parsers disagree on \"" << frame << "\"" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t sink = 0; // Keeps the parse results alive
+    double stream_rate = commands_per_second(corpus, rounds, [&](const std::string& frame) {
+        Command cmd = parse_stream(frame, arg, body);
+        sink += size_t(cmd.type) + cmd.arg.size() + cmd.body.size();
+    });
+    double view_rate = commands_per_second(corpus, rounds, [&](const std::string& frame) {
+        Command cmd = parse_command(frame);
+        sink += size_t(cmd.type) + cmd.arg.size() + cmd.body.size();
+    });
+
+    std::cout << "Parsed " << rounds * corpus.size() << " commands per parser (checksum " << sink << ")" << std::endl;
+    std::cout << "istringstream: " << stream_rate / 1e6 << " M commands/s" << std::endl;
+    std::cout << "string_view:   " << view_rate / 1e6 << " M commands/s" << std::endl;
+    std::cout << "Speedup: " << view_rate / stream_rate << "x" << std::endl;
+    return 0;
+}
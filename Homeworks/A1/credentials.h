@@ -0,0 +1,132 @@
+// In-memory credential index for the chat server.
+//
+// users.txt ("username:password" per line) is parsed once into a hash map that is
+// published as an immutable snapshot. Logins look up the current snapshot without
+// taking a lock that a reload would contend on; reload() builds a complete new index
+// off to the side and swaps it in atomically, so a login in progress keeps the
+// snapshot it started with. A watcher thread reloads on inotify events for the file.
+
+#ifndef CREDENTIALS_H
+#define CREDENTIALS_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+class CredentialStore {
+public:
+    using Index = std::unordered_map<std::string, std::string>; // Username -> Password
+
+    struct Stats {
+        Histogram lookup_ns; // Time to check one login against the index
+        Counter reloads;
+    };
+
+    explicit CredentialStore(std::string path) : path_(std::move(path)) {}
+
+    // Parse the credential file and publish it. On failure the previous index stays live.
+    bool reload() {
+        std::ifstream user_file(path_);
+        if (!user_file.is_open()) {
+            std::cerr << "Could not open credential file " << path_ << std::endl;
+            return false;
+        }
+
+        auto next = std::make_shared<Index>();
+        std::string line, stored_user, stored_pass;
+        while (std::getline(user_file, line)) {
+            std::istringstream iss(line);
+
+            std::getline(iss, stored_user, ':');
+            std::getline(iss, stored_pass);
+            next->emplace(stored_user, stored_pass);
+        }
+
+        size_t count = next->size();
+        index_.store(std::move(next));
+        stats_.reloads.add();
+        std::cout << "Loaded " << count << " users from " << path_ << std::endl;
+        return true;
+    }
+
+    bool authenticate(const std::string& username, std::string_view password) {
+        ScopedTimer timer(stats_.lookup_ns);
+
+        std::shared_ptr<const Index> index = index_.load();
+        bool ok = false;
+        if (index) {
+            auto it = index->find(username);
+            ok = it != index->end() && it->second == password;
+        }
+        return ok;
+    }
+
+    // Block on inotify and reload whenever the file is rewritten or replaced.
+    // The directory is watched because editors and scripts usually rename a new file into place.
+    void watch() {
+        int fd = inotify_init1(IN_CLOEXEC);
+        if (fd < 0) {
+            perror("inotify_init1");
+            return;
+        }
+
+        size_t slash = path_.find_last_of('/');
+        std::string dir = (slash == std::string::npos) ? "." : path_.substr(0, slash + 1);
+        std::string name = (slash == std::string::npos) ? path_ : path_.substr(slash + 1);
+
+        if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            perror("inotify_add_watch");
+            close(fd);
+            return;
+        }
+
+        alignas(inotify_event) char buffer[4096];
+        while (true) {
+            ssize_t len = read(fd, buffer, sizeof(buffer));
+            if (len <= 0) {
+                if (len < 0 && errno == EINTR) continue;
+                break;
+            }
+
+            bool changed = false;
+            for (char* p = buffer; p < buffer + len; ) {
+                auto* event = reinterpret_cast<inotify_event*>(p);
+                if (event->len > 0 && name == event->name) changed = true;
+                p += sizeof(inotify_event) + event->len;
+            }
+            if (changed) reload();
+        }
+        close(fd);
+    }
+
+    bool exists(const std::string& username) const {
+        std::shared_ptr<const Index> index = index_.load();
+        return index && index->count(username) > 0;
+    }
+
+    size_t size() const {
+        std::shared_ptr<const Index> index = index_.load();
+        return index ? index->size() : 0;
+    }
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    std::string path_;
+    std::atomic<std::shared_ptr<const Index>> index_;
+    Stats stats_;
+};
+
+#endif // CREDENTIALS_H
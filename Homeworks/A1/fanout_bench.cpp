@@ -0,0 +1,139 @@
+// Benchmark for group message fan-out.
+//
+// Sends group messages to every member of one large group the way group_message() does:
+// the "[Group g] sender: text" frame is encoded into one Payload per message, and every
+// member's connection gets it through its OutboundQueue, which writes it straight to the
+// member's socket (one end of a socketpair, drained between messages outside the timing).
+// Members are found once through the lookup the server used before (usernames, each
+// resolved through the sharded username map) and once through the current one (user IDs,
+// each indexing the online slot table). Both must deliver the same bytes to every member
+// but the sender; reports deliveries per second for each.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "outbound.h"
+#include "payload.h"
+#include "state_store.h"
+
+#define GROUP_MEMBERS 1000
+#define MESSAGE_BYTES 64
+
+
+
+struct Conn {
+    Conn(int server_fd, int client_fd, const OutboundLimits& limits, OutboundStats& stats)
+        : out(server_fd, limits, stats), client_fd(client_fd) {}
+    ~Conn() { out.close_socket(); close(client_fd); }
+
+    OutboundQueue out;
+    int client_fd;         // Member's end, read back by drain()
+    uint64_t received = 0; // Bytes read from client_fd
+};
+
+// Read everything the fan-out wrote to the members' sockets
+void drain(const std::vector<std::shared_ptr<Conn>>& conns) {
+    char buf[64 * 1024];
+    for (const auto& conn : conns) {
+        ssize_t n;
+        while ((n = recv(conn->client_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) conn->received += n;
+    }
+}
+
+// Seconds spent in rounds calls to fanout(), draining the sockets in between
+template <typename F>
+double fanout_seconds(size_t rounds, const std::vector<std::shared_ptr<Conn>>& conns, F&& fanout) {
+    std::chrono::duration<double> elapsed{0};
+    for (size_t r = 0; r < rounds; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        fanout();
+        elapsed += std::chrono::steady_clock::now() - start;
+        drain(conns);
+    }
+    return elapsed.count();
+}
+
+int main(int argc, char* argv[]) {
+    size_t rounds = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+    size_t size = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : GROUP_MEMBERS;
+    if (size < 2) size = 2;
+
+    // Every member is online. Names are interned in login order, like on the server.
+    OutboundLimits limits;
+    OutboundStats stats;
+    InternTable user_ids;
+    ShardedMap<std::string, std::shared_ptr<Conn>> user_sockets;
+    SlotTable<Conn> online;
+    std::vector<std::shared_ptr<Conn>> conns;
+    std::vector<std::string> names;
+    std::vector<uint32_t> ids;
+    for (size_t i = 0; i < size; ++i) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+            perror("socketpair");
+            return EXIT_FAILURE;
+        }
+        std::string name = "user" + std::to_string(i);
+        conns.push_back(std::make_shared<Conn>(fds[0], fds[1], limits, stats));
+        user_sockets.insert_or_assign(name, conns.back());
+        online.store(user_ids.intern(name), conns.back());
+        names.push_back(name);
+    }
+    std::sort(names.begin(), names.end()); // The old member list was sorted by name
+    for (const std::string& name : names) ids.push_back(user_ids.find(name));
+    std::sort(ids.begin(), ids.end());
+
+    const std::string& sender = names[0];
+    uint32_t sender_id = user_ids.find(sender);
+    std::string group = "g";
+    std::string message(MESSAGE_BYTES, 'x');
+    size_t left_queued = 0; // Pushes that could not write the whole frame, should stay 0
+
+    auto by_name = [&]() {
+        Payload payload = make_payload({"[Group ", group, "] ", sender, ": ", message});
+        for (const std::string& member : names) {
+            if (member != sender) {
+                user_sockets.visit(member, [&](const std::shared_ptr<Conn>& conn) { left_queued += conn->out.push(payload); });
+            }
+        }
+    };
+    auto by_id = [&]() {
+        Payload payload = make_payload({"[Group ", group, "] ", sender, ": ", message});
+        for (uint32_t member : ids) {
+            if (member != sender_id) {
+                std::shared_ptr<Conn> conn = online.load(member);
+                if (conn) left_queued += conn->out.push(payload);
+            }
+        }
+    };
+
+    double name_time = fanout_seconds(rounds, conns, by_name);
+    double id_time = fanout_seconds(rounds, conns, by_id);
+
+    // Both must reach every member but the sender, with one frame per message
+    uint64_t frame = FRAME_HEADER_SIZE + std::string("[Group ] : ").size() + group.size() + sender.size() + message.size();
+    std::shared_ptr<Conn> sender_conn = online.load(sender_id);
+    for (const auto& conn : conns) {
+        uint64_t expected = conn == sender_conn ? 0 : 2 * rounds * frame;
+        if (conn->received != expected) {
+            std::cerr << "Fan-outs disagree on the recipients" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (left_queued > 0) std::cerr << left_queued << " pushes left bytes queued" << std::endl;
+
+    double deliveries = double(rounds) * (size - 1);
+    std::cout << "Fanned out " << rounds << " messages of " << frame << " bytes to a group of " << size
+              << " per lookup, encode + OutboundQueue push to a socket per member" << std::endl;
+    std::cout << "username map: " << deliveries / name_time / 1e6 << " M deliveries/s" << std::endl;
+    std::cout << "ID slot table: " << deliveries / id_time / 1e6 << " M deliveries/s" << std::endl;
+    std::cout << "Speedup: " << name_time / id_time << "x" << std::endl;
+    return 0;
+}
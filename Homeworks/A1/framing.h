@@ -0,0 +1,201 @@
+// Length-prefixed framing shared by the chat client and server.
+//
+// Every message on the wire is a 4-byte big-endian payload length followed by the
+// payload bytes. TCP is free to split or coalesce writes, so readers append whatever
+// recv() returns to a FrameReader and pull out as many complete frames as it holds.
+
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+#include "buffer_pool.h"
+
+#define FRAME_HEADER_SIZE 4
+#define MAX_FRAME_SIZE (64 * 1024)
+
+// Append one frame carrying payload to out, so several frames can go out in one send()
+
+inline void append_frame(std::string& out, std::string_view payload) {
+    uint32_t len = static_cast<uint32_t>(payload.size());
+    char header[FRAME_HEADER_SIZE] = {
+        static_cast<char>((len >> 24) & 0xff),
+        static_cast<char>((len >> 16) & 0xff),
+        static_cast<char>((len >> 8) & 0xff),
+        static_cast<char>(len & 0xff),
+    };
+    out.append(header, FRAME_HEADER_SIZE);
+    out.append(payload.data(), payload.size());
+}
+
+// Size of the concatenation of parts
+inline size_t parts_size(std::initializer_list<std::string_view> parts) {
+    size_t len = 0;
+    for (std::string_view part : parts) len += part.size();
+    return len;
+}
+
+// Append the concatenation of parts to out, cut off after limit bytes
+inline void append_parts(std::string& out, std::initializer_list<std::string_view> parts, size_t limit) {
+    for (std::string_view part : parts) {
+        size_t n = std::min(part.size(), limit);
+        out.append(part.data(), n);
+        limit -= n;
+    }
+}
+
+inline std::string encode_frame(std::string_view payload) {
+    std::string out;
+    out.reserve(FRAME_HEADER_SIZE + payload.size());
+    append_frame(out, payload);
+    return out;
+}
+
+// Per-connection read buffer that splits the byte stream back into frames. The storage
+// comes from a BufferPool: a buffer of the smallest class, swapped for a bigger one only
+// while a frame that doesn't fit is being received, and returned when the reader goes away.
+// Readers can recv() straight into it (write_area() + commit()) instead of copying.
+
+static_assert(BufferPool::largest() >= FRAME_HEADER_SIZE + MAX_FRAME_SIZE, "largest receive buffer must hold a full frame");
+
+class FrameReader {
+public:
+    explicit FrameReader(BufferPool& pool = recv_buffers) : pool_(&pool) {}
+    ~FrameReader() { release(); }
+
+    FrameReader(const FrameReader&) = delete;
+    FrameReader& operator=(const FrameReader&) = delete;
+
+    FrameReader(FrameReader&& other) noexcept { take(other); }
+    FrameReader& operator=(FrameReader&& other) noexcept {
+        if (this != &other) {
+            release();
+            take(other);
+        }
+        return *this;
+    }
+
+    // Free space at the end of the buffer, at least one byte and enough for the frame in progress
+    char* write_area(size_t& room) {
+        if (!buf_) buf_ = pool_->acquire(class_);
+
+        if (bad_) head_ = tail_ = 0;
+        trim();
+
+        size_t need = buffered() + 1;
+        if (buffered() >= FRAME_HEADER_SIZE) {
+            size_t len = frame_length(buf_ + head_);
+            if (len <= MAX_FRAME_SIZE) need = std::max(need, FRAME_HEADER_SIZE + len);
+        }
+
+        size_t capacity = BufferPool::class_size(class_);
+        if (need > capacity) {
+            resize(BufferPool::class_for(need));
+        }
+        else if (head_ > 0 && (tail_ == capacity || head_ + need > capacity)) {
+            // Move the partial frame to the front
+            std::memmove(buf_, buf_ + head_, buffered());
+            tail_ -= head_;
+            head_ = 0;
+        }
+
+        room = BufferPool::class_size(class_) - tail_;
+        return buf_ + tail_;
+    }
+
+    // Mark len bytes written into the write_area() as received
+    void commit(size_t len) { tail_ += len; }
+
+    // Copy freshly received bytes into the buffer
+    void append(const char* data, size_t len) {
+        while (len > 0) {
+            size_t room;
+            char* area = write_area(room);
+            size_t n = std::min(room, len);
+            std::memcpy(area, data, n);
+            commit(n);
+            data += n;
+            len -= n;
+        }
+    }
+
+    // Pull the next complete frame. The view stays valid until the next write_area() or append().
+    // Returns false when more bytes are needed or the stream is corrupt (see bad()).
+    bool next(std::string_view& frame) {
+        if (bad_ || buffered() < FRAME_HEADER_SIZE) return false;
+
+        uint32_t len = frame_length(buf_ + head_);
+        if (len > MAX_FRAME_SIZE) {
+            bad_ = true;
+            return false;
+        }
+        if (buffered() < FRAME_HEADER_SIZE + len) return false;
+
+        frame = std::string_view(buf_ + head_ + FRAME_HEADER_SIZE, len);
+        head_ += FRAME_HEADER_SIZE + len;
+        return true;
+    }
+
+    // Set once a frame header announces more than MAX_FRAME_SIZE bytes
+    bool bad() const { return bad_; }
+
+    size_t buffered() const { return tail_ - head_; }
+
+    // Once every frame is consumed, drop back to the smallest buffer. Invalidates views from next().
+    void trim() {
+        if (head_ != tail_) return;
+        head_ = tail_ = 0;
+        if (class_ > 0) resize(0);
+    }
+
+    // Give the buffer back to the pool, buffered bytes are dropped
+    void release() {
+        if (buf_) pool_->release(buf_, class_);
+        buf_ = nullptr;
+        class_ = 0;
+        head_ = tail_ = 0;
+    }
+
+private:
+    static uint32_t frame_length(const char* header) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(header);
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+
+    // Move the buffered bytes into a buffer of another size class
+    void resize(size_t size_class) {
+        char* next = pool_->acquire(size_class);
+        std::memcpy(next, buf_ + head_, buffered());
+        pool_->release(buf_, class_);
+        buf_ = next;
+        class_ = size_class;
+        tail_ -= head_;
+        head_ = 0;
+    }
+
+    void take(FrameReader& other) {
+        pool_ = other.pool_;
+        buf_ = other.buf_;
+        class_ = other.class_;
+        head_ = other.head_;
+        tail_ = other.tail_;
+        bad_ = other.bad_;
+        other.buf_ = nullptr;
+        other.class_ = 0;
+        other.head_ = other.tail_ = 0;
+    }
+
+    BufferPool* pool_;
+    char* buf_ = nullptr;
+    size_t class_ = 0; // Size class of buf_
+    size_t head_ = 0;  // Start of the first unconsumed frame
+    size_t tail_ = 0;  // End of the received bytes
+    bool bad_ = false;
+};
+
+#endif // FRAMING_H
@@ -0,0 +1,460 @@
+// Load generator for the chat server.
+//
+// Opens many client connections from a few epoll threads, logs them in with the
+// accounts in users.txt, puts them into groups and then replays a weighted mix of
+// /broadcast, /msg and /group_msg commands. Every command carries its send time, so
+// each delivery that arrives back at any generated client yields one latency sample.
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <fstream>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+
+#include "binary_protocol.h"
+#include "framing.h"
+
+#define BUFFER_SIZE 65536
+#define MAX_EVENTS 512
+#define STAMP_MARK "#t="
+
+
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 12345;
+    std::string users_file = "users.txt";
+    int clients = 1000;
+    int threads = 4;
+    int groups = 10;
+    double duration = 10.0;   // Seconds of measured traffic
+    double rate = 1.0;        // Commands per second per client
+    int weights[3] = {1, 8, 1}; // broadcast : msg : group_msg
+    int payload = 32;         // Filler bytes per message
+    int ramp = 8;             // Logins in flight per thread, 0 = connect every client at once
+    bool binary = false;      // Negotiate the binary protocol (binary_protocol.h)
+};
+
+Options opts;
+
+// Setup phases, every connection must finish one before anyone starts the next
+enum class Phase { CONNECT, LOGIN, CREATE_GROUPS, JOIN_GROUPS, RUN, DONE };
+
+std::atomic<Phase> phase{Phase::LOGIN};
+std::atomic<int> phase_done{0};
+std::atomic<int> failed{0};
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+
+struct Client {
+    int fd = -1;
+    int index = 0;
+    std::string username, password;
+    FrameReader reader;
+    std::string outbuf; // Encoded frames not yet accepted by the socket
+    int replies = 0;    // Frames received during the login handshake
+    Phase done = Phase::CONNECT; // Last phase this client completed
+    bool want_write = false;
+    uint64_t connect_ns = 0; // When connect() was called
+};
+
+struct ThreadStats {
+    uint64_t sent = 0;
+    uint64_t delivered = 0;
+    uint64_t other = 0; // Frames without a timestamp (errors, join notices, ...)
+    std::vector<uint64_t> latencies_ns;
+    std::vector<uint64_t> login_ns; // connect() to the welcome message
+};
+
+std::vector<std::pair<std::string, std::string>> users;
+
+// Binary protocol: IDs the server has named so far, shared by all connections (0 = not yet)
+std::unordered_map<std::string, int> user_index;
+std::vector<std::atomic<uint32_t>> user_ids;
+std::vector<std::atomic<uint32_t>> group_ids;
+
+
+
+void queue_frame(Client& c, const std::string& text) {
+    if (opts.binary) append_binary(c.outbuf, BinaryOp::TEXT, 0, 0, {text});
+    else append_frame(c.outbuf, text);
+}
+
+// Push as much of the output buffer as the socket takes, false on error
+bool flush(Client& c, int epfd) {
+    while (!c.outbuf.empty()) {
+        ssize_t n = send(c.fd, c.outbuf.data(), c.outbuf.size(), MSG_NOSIGNAL);
+        if (n > 0) {
+            c.outbuf.erase(0, n);
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        else if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        else {
+            return false;
+        }
+    }
+
+    bool want = !c.outbuf.empty();
+    if (want != c.want_write) {
+        epoll_event ev{};
+        ev.events = EPOLLIN | (want ? uint32_t(EPOLLOUT) : 0u);
+        ev.data.ptr = &c;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+        c.want_write = want;
+    }
+    return true;
+}
+
+std::string group_of(const Client& c) {
+    return "lg" + std::to_string(c.index % opts.groups);
+}
+
+void finish_phase(Client& c, Phase p) {
+    if (c.done < p) {
+        c.done = p;
+        phase_done.fetch_add(1);
+    }
+}
+
+// Handle one frame from the server
+void on_frame(Client& c, std::string_view frame, ThreadStats& stats) {
+    Phase current = phase.load();
+
+    if (c.done < Phase::LOGIN) {
+        // Prompts arrive in order: username, password, then welcome or failure
+        ++c.replies;
+        if (c.replies == 1) queue_frame(c, c.username);
+        else if (c.replies == 2) queue_frame(c, c.password);
+        else if (c.replies == 3) {
+            if (frame.find("Welcome") == std::string_view::npos) failed.fetch_add(1);
+            else stats.login_ns.push_back(now_ns() - c.connect_ns);
+            finish_phase(c, Phase::LOGIN);
+        }
+        return;
+    }
+
+    size_t mark = frame.find(STAMP_MARK);
+    if (mark != std::string_view::npos) {
+        uint64_t sent = std::strtoull(frame.data() + mark + strlen(STAMP_MARK), nullptr, 10);
+        uint64_t now = now_ns();
+        if (current == Phase::RUN && sent > 0 && now >= sent) {
+            stats.latencies_ns.push_back(now - sent);
+            ++stats.delivered;
+        }
+        return;
+    }
+
+    ++stats.other;
+    BinaryFrame named;
+    if (opts.binary && parse_binary(frame, named) && named.op != BinaryOp::TEXT) {
+        if (named.op == BinaryOp::USER_NAME) {
+            auto it = user_index.find(std::string(named.body));
+            if (it != user_index.end()) user_ids[it->second].store(named.ids[0], std::memory_order_relaxed);
+        }
+        else if (named.op == BinaryOp::GROUP_NAME && named.body.substr(0, 2) == "lg") {
+            size_t g = std::strtoul(std::string(named.body.substr(2)).c_str(), nullptr, 10);
+            if (g < group_ids.size()) group_ids[g].store(named.ids[0], std::memory_order_relaxed);
+        }
+        return;
+    }
+    if (current == Phase::CREATE_GROUPS && frame.find("created") != std::string_view::npos) {
+        finish_phase(c, Phase::CREATE_GROUPS);
+    }
+    else if (current == Phase::JOIN_GROUPS && frame.find("joined the group") != std::string_view::npos) {
+        finish_phase(c, Phase::JOIN_GROUPS);
+    }
+}
+
+// Queue the next command from the configured mix. Over the binary protocol messages go by ID
+// once the server has named the recipient or group, as text commands until then.
+void queue_command(Client& c, std::mt19937_64& rng) {
+    int total = opts.weights[0] + opts.weights[1] + opts.weights[2];
+    int pick = std::uniform_int_distribution<int>(0, total - 1)(rng);
+    std::string body = std::string(opts.payload, 'x') + STAMP_MARK + std::to_string(now_ns());
+
+    if (pick < opts.weights[0]) {
+        if (opts.binary) append_binary(c.outbuf, BinaryOp::BROADCAST, 0, 0, {body});
+        else queue_frame(c, "/broadcast " + body);
+        return;
+    }
+    if (pick < opts.weights[0] + opts.weights[1]) {
+        int to = std::uniform_int_distribution<int>(0, opts.clients - 1)(rng);
+        uint32_t id = opts.binary ? user_ids[to].load(std::memory_order_relaxed) : 0;
+        if (id) append_binary(c.outbuf, BinaryOp::MSG, id, 0, {body});
+        else queue_frame(c, "/msg " + users[to].first + " " + body);
+        return;
+    }
+    uint32_t id = opts.binary ? group_ids[c.index % opts.groups].load(std::memory_order_relaxed) : 0;
+    if (id) append_binary(c.outbuf, BinaryOp::GROUP_MSG, id, 0, {body});
+    else queue_frame(c, "/group_msg " + group_of(c) + " " + body);
+}
+
+
+
+void run_thread(int id, std::vector<Client>& clients, ThreadStats& stats) {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opts.port);
+    inet_pton(AF_INET, opts.host.c_str(), &addr.sin_addr);
+
+    size_t next_connect = 0;
+    int pending_logins = 0;
+
+    // Open connections while fewer than opts.ramp logins are in flight
+    auto connect_more = [&]() {
+        while (next_connect < clients.size() && (opts.ramp == 0 || pending_logins < opts.ramp)) {
+            Client& c = clients[next_connect++];
+            c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            int one = 1;
+            setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            c.connect_ns = now_ns();
+            if (connect(c.fd, (sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+                perror("connect");
+                failed.fetch_add(1);
+                finish_phase(c, Phase::LOGIN);
+                continue;
+            }
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = &c;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+            ++pending_logins;
+            if (opts.binary) {
+                append_frame(c.outbuf, BINARY_HELLO);
+                flush(c, epfd);
+            }
+        }
+    };
+    connect_more();
+
+    std::mt19937_64 rng(id * 7919 + 1);
+    char buffer[BUFFER_SIZE];
+    epoll_event events[MAX_EVENTS];
+    Phase seen = Phase::LOGIN;
+    uint64_t last_tick = now_ns();
+    double owed = 0; // Commands due but not yet sent
+    size_t next_client = 0;
+
+    while (phase.load() != Phase::DONE) {
+        int ready = epoll_wait(epfd, events, MAX_EVENTS, 1);
+        for (int e = 0; e < ready; ++e) {
+            Client& c = *static_cast<Client*>(events[e].data.ptr);
+            if (events[e].events & EPOLLIN) {
+                while (true) {
+                    ssize_t n = recv(c.fd, buffer, BUFFER_SIZE, 0);
+                    if (n > 0) {
+                        bool logging_in = c.done < Phase::LOGIN;
+                        c.reader.append(buffer, n);
+                        std::string_view frame;
+                        while (c.reader.next(frame)) on_frame(c, frame, stats);
+                        if (logging_in && c.done >= Phase::LOGIN) --pending_logins;
+                        continue;
+                    }
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                        epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+                        if (c.done < Phase::LOGIN) {
+                            // Dropped before the handshake finished, count it and move on
+                            failed.fetch_add(1);
+                            finish_phase(c, Phase::LOGIN);
+                            --pending_logins;
+                        }
+                    }
+                    break;
+                }
+            }
+            flush(c, epfd);
+        }
+        connect_more();
+
+        // React to phase changes published by the main thread
+        Phase current = phase.load();
+        if (current != seen) {
+            seen = current;
+            for (Client& c : clients) {
+                if (current == Phase::CREATE_GROUPS) {
+                    if (c.index < opts.groups) queue_frame(c, "/create_group " + group_of(c));
+                    else finish_phase(c, Phase::CREATE_GROUPS);
+                }
+                else if (current == Phase::JOIN_GROUPS) {
+                    if (c.index >= opts.groups) queue_frame(c, "/join_group " + group_of(c));
+                    else finish_phase(c, Phase::JOIN_GROUPS);
+                }
+                flush(c, epfd);
+            }
+            last_tick = now_ns();
+        }
+
+        if (current == Phase::RUN && !clients.empty()) {
+            uint64_t now = now_ns();
+            owed += (now - last_tick) * 1e-9 * opts.rate * clients.size();
+            last_tick = now;
+            for (; owed >= 1; owed -= 1) {
+                Client& c = clients[next_client++ % clients.size()];
+                queue_command(c, rng);
+                ++stats.sent;
+                flush(c, epfd);
+            }
+        }
+    }
+
+    for (Client& c : clients) close(c.fd);
+    close(epfd);
+}
+
+
+
+// Wait until every client finished the current phase (or the timeout passed)
+bool wait_phase(const char* what) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (phase_done.load() < opts.clients) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            std::cerr << "Timed out during " << what << ": " << phase_done.load() << "/" << opts.clients << std::endl;
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    phase_done.store(0);
+    return true;
+}
+
+uint64_t percentile(std::vector<uint64_t>& v, double p) {
+    if (v.empty()) return 0;
+    size_t k = std::min(v.size() - 1, size_t(p * v.size()));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--host H] [--port P] [--users FILE] [--clients N] [--threads T]\n"
+              << "       [--groups G] [--duration SEC] [--rate CMDS_PER_SEC_PER_CLIENT]\n"
+              << "       [--mix BROADCAST:MSG:GROUP_MSG] [--payload BYTES] [--ramp LOGINS_IN_FLIGHT]\n"
+              << "       [--protocol text|binary]" << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) usage(argv[0]);
+        std::string val = argv[++i];
+        if (arg == "--host") opts.host = val;
+        else if (arg == "--port") opts.port = std::atoi(val.c_str());
+        else if (arg == "--users") opts.users_file = val;
+        else if (arg == "--clients") opts.clients = std::atoi(val.c_str());
+        else if (arg == "--threads") opts.threads = std::max(1, std::atoi(val.c_str()));
+        else if (arg == "--groups") opts.groups = std::max(1, std::atoi(val.c_str()));
+        else if (arg == "--duration") opts.duration = std::atof(val.c_str());
+        else if (arg == "--rate") opts.rate = std::atof(val.c_str());
+        else if (arg == "--payload") opts.payload = std::max(0, std::atoi(val.c_str()));
+        else if (arg == "--ramp") opts.ramp = std::max(0, std::atoi(val.c_str()));
+        else if (arg == "--protocol" && (val == "text" || val == "binary")) opts.binary = val == "binary";
+        else if (arg == "--mix") {
+            if (sscanf(val.c_str(), "%d:%d:%d", &opts.weights[0], &opts.weights[1], &opts.weights[2]) != 3 ||
+                opts.weights[0] + opts.weights[1] + opts.weights[2] <= 0) usage(argv[0]);
+        }
+        else usage(argv[0]);
+    }
+
+    std::ifstream user_file(opts.users_file);
+    std::string line;
+    while (std::getline(user_file, line)) {
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) users.emplace_back(line.substr(0, colon), line.substr(colon + 1));
+    }
+    opts.clients = std::min<int>(opts.clients, users.size());
+    opts.groups = std::min(opts.groups, std::max(1, opts.clients));
+    for (size_t i = 0; i < users.size(); ++i) user_index.emplace(users[i].first, int(i));
+    user_ids = std::vector<std::atomic<uint32_t>>(users.size());
+    group_ids = std::vector<std::atomic<uint32_t>>(opts.groups);
+    if (opts.clients == 0) {
+        std::cerr << "No users in " << opts.users_file << std::endl;
+        return 1;
+    }
+
+    // Deal the clients out round-robin so each thread owns a fixed slice
+    std::vector<std::vector<Client>> slices(opts.threads);
+    for (int i = 0; i < opts.clients; ++i) {
+        Client c;
+        c.index = i;
+        c.username = users[i].first;
+        c.password = users[i].second;
+        slices[i % opts.threads].push_back(std::move(c));
+    }
+    std::vector<ThreadStats> stats(opts.threads);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < opts.threads; ++t) {
+        workers.emplace_back(run_thread, t, std::ref(slices[t]), std::ref(stats[t]));
+    }
+
+    uint64_t login_start = now_ns();
+    bool ok = wait_phase("login");
+    if (ok) {
+        std::vector<uint64_t> login_ns;
+        for (ThreadStats& s : stats) login_ns.insert(login_ns.end(), s.login_ns.begin(), s.login_ns.end());
+        std::cout << "Logged in " << opts.clients - failed.load() << "/" << opts.clients << " clients in "
+                  << (now_ns() - login_start) / 1000000 << " ms" << std::endl;
+        std::cout << "Login latency us (connect to welcome): p50 " << percentile(login_ns, 0.50) / 1000
+                  << "  p99 " << percentile(login_ns, 0.99) / 1000
+                  << "  max " << percentile(login_ns, 1.0) / 1000 << std::endl;
+        phase.store(Phase::CREATE_GROUPS);
+        ok = wait_phase("group creation");
+    }
+    if (ok) {
+        phase.store(Phase::JOIN_GROUPS);
+        ok = wait_phase("group join");
+    }
+
+    uint64_t start = now_ns();
+    if (ok) {
+        phase.store(Phase::RUN);
+        std::this_thread::sleep_for(std::chrono::duration<double>(opts.duration));
+    }
+    double elapsed = (now_ns() - start) * 1e-9;
+    phase.store(Phase::DONE);
+    for (auto& worker : workers) worker.join();
+    if (!ok) return 1;
+
+    ThreadStats total;
+    for (ThreadStats& s : stats) {
+        total.sent += s.sent;
+        total.delivered += s.delivered;
+        total.other += s.other;
+        total.latencies_ns.insert(total.latencies_ns.end(), s.latencies_ns.begin(), s.latencies_ns.end());
+    }
+
+    std::cout << "Clients: " << opts.clients << "  threads: " << opts.threads << "  groups: " << opts.groups
+              << "  mix: " << opts.weights[0] << ":" << opts.weights[1] << ":" << opts.weights[2] << std::endl;
+    std::cout << "Sent " << total.sent << " commands (" << uint64_t(total.sent / elapsed) << "/s), received "
+              << total.delivered << " deliveries (" << uint64_t(total.delivered / elapsed) << "/s), "
+              << total.other << " other frames" << std::endl;
+    std::cout << "Delivery latency us: p50 " << percentile(total.latencies_ns, 0.50) / 1000
+              << "  p99 " << percentile(total.latencies_ns, 0.99) / 1000
+              << "  p999 " << percentile(total.latencies_ns, 0.999) / 1000 << std::endl;
+    return 0;
+}
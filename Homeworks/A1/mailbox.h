@@ -0,0 +1,191 @@
+// Offline mailboxes for private and group messages.
+//
+// A message for a known user who is not logged in is kept in that user's mailbox and
+// handed over, as one buffer of frames, when they next authenticate. Mailboxes hold
+// references to the already-encoded Payloads, so a group message waiting for several
+// offline members is stored once. Memory is capped per user and in total; past the cap
+// messages are appended to a per-user spill file when a spill directory is configured
+// (itself capped per user), and dropped otherwise. Once a user's messages have started
+// going to disk, later ones follow them there, so delivery keeps the order of arrival.
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <deque>
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "framing.h"
+#include "metrics.h"
+#include "payload.h"
+#include "state_store.h"
+
+class MailboxStore {
+public:
+    struct Limits {
+        size_t user_bytes = 64 << 10;   // In memory per user, 0 disables mailboxes
+        size_t total_bytes = 64 << 20;  // In memory over all users
+        std::string spill_dir;          // Where to spill past the memory caps, empty = drop instead
+        size_t user_disk_bytes = 1 << 20;
+    };
+
+    enum class Result { DELIVERED, STORED, FULL };
+
+    struct Stats {
+        Counter stored;
+        Counter spilled;   // Stored on disk rather than in memory
+        Counter dropped;   // Mailbox full
+        Counter delivered; // Messages handed over at login
+        Gauge bytes;       // Held in memory
+        Gauge messages;    // Held in memory
+    };
+
+    explicit MailboxStore(Limits limits, Histogram* lock_wait = nullptr) : limits_(std::move(limits)), boxes_(lock_wait) {}
+
+    bool enabled() const { return limits_.user_bytes > 0; }
+
+    // Keep frame for user unless online() delivers it first. online() runs under the mailbox's
+    // lock, so a login draining the mailbox can't slip in between the check and the store.
+    template <typename Online>
+    Result deposit(std::string_view user, const Payload& frame, Online&& online) {
+        Result result = Result::FULL;
+        boxes_.upsert(user, [&](Mailbox& box) {
+            if (online()) {
+                result = Result::DELIVERED;
+                return;
+            }
+            if (!box.checked_disk) {
+                // Messages spilled by a previous run must stay ahead of new ones
+                box.on_disk = !limits_.spill_dir.empty() && access(spill_path(user).c_str(), F_OK) == 0;
+                box.checked_disk = true;
+            }
+
+            size_t size = frame->size();
+            if (!box.on_disk && box.bytes + size <= limits_.user_bytes &&
+                stats_.bytes.value() + int64_t(size) <= int64_t(limits_.total_bytes)) {
+                box.frames.push_back(frame);
+                box.bytes += size;
+                stats_.bytes.add(size);
+                stats_.messages.add(1);
+                result = Result::STORED;
+            }
+            else if (!limits_.spill_dir.empty() && spill(user, *frame)) {
+                box.on_disk = true;
+                stats_.spilled.add();
+                result = Result::STORED;
+            }
+        });
+
+        if (result == Result::STORED) stats_.stored.add();
+        if (result == Result::FULL) stats_.dropped.add();
+        return result;
+    }
+
+    // Append everything waiting for user (oldest first) to out as encoded frames, returns the count.
+    // The emptied mailbox stays in place, so the number of entries is bounded by the known users.
+    size_t take(std::string_view user, std::string& out) {
+        size_t count = 0;
+        boxes_.upsert(user, [&](Mailbox& box) {
+            for (const Payload& frame : box.frames) out += *frame;
+            count = box.frames.size();
+            stats_.bytes.add(-int64_t(box.bytes));
+            stats_.messages.add(-int64_t(count));
+            box.frames.clear();
+            box.bytes = 0;
+
+            // The spill file may also be left over from a previous run
+            if (!limits_.spill_dir.empty()) count += unspill(user, out);
+            box.on_disk = false;
+            box.checked_disk = true;
+        });
+
+        stats_.delivered.add(count);
+        return count;
+    }
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Mailbox {
+        std::deque<Payload> frames;
+        size_t bytes = 0;
+        bool on_disk = false; // Later messages go to the spill file too
+        bool checked_disk = false;
+    };
+
+    // Usernames come from users.txt, escape anything that isn't safe in a file name
+    std::string spill_path(std::string_view user) const {
+        std::string path = limits_.spill_dir + "/";
+        for (char c : user) {
+            if (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-' || c == '.') {
+                path += c;
+            }
+            else {
+                char escaped[4];
+                std::snprintf(escaped, sizeof(escaped), "%%%02X", static_cast<unsigned char>(c));
+                path += escaped;
+            }
+        }
+        return path + ".mbox";
+    }
+
+    bool spill(std::string_view user, const std::string& frame) {
+        std::string path = spill_path(user);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            perror("Mailbox spill");
+            return false;
+        }
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0 && size_t(st.st_size) + frame.size() <= limits_.user_disk_bytes;
+        if (ok && write(fd, frame.data(), frame.size()) != ssize_t(frame.size())) {
+            // Cut off a torn frame, or the frames spilled after it would be read back misaligned
+            perror("Mailbox spill");
+            if (ftruncate(fd, st.st_size) != 0) perror("Mailbox spill truncate");
+            ok = false;
+        }
+        close(fd);
+        return ok;
+    }
+
+    // Move the spill file's frames to out and delete it, returns how many there were
+    size_t unspill(std::string_view user, std::string& out) {
+        std::string path = spill_path(user);
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return 0;
+
+        size_t start = out.size();
+        char chunk[16 * 1024];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) > 0 || (n < 0 && errno == EINTR)) {
+            if (n > 0) out.append(chunk, n);
+        }
+        close(fd);
+        unlink(path.c_str());
+
+        // Count whole frames, a torn one at the end (crash mid-write) is cut off
+        size_t count = 0;
+        size_t pos = start;
+        while (out.size() - pos >= FRAME_HEADER_SIZE) {
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(out.data() + pos);
+            size_t len = (size_t(p[0]) << 24) | (size_t(p[1]) << 16) | (size_t(p[2]) << 8) | size_t(p[3]);
+            if (out.size() - pos - FRAME_HEADER_SIZE < len) break;
+            pos += FRAME_HEADER_SIZE + len;
+            ++count;
+        }
+        out.resize(pos);
+        return count;
+    }
+
+    Limits limits_;
+    ShardedMap<std::string, Mailbox> boxes_; // Username -> Mailbox
+    Stats stats_;
+};
+
+#endif // MAILBOX_H
@@ -0,0 +1,454 @@
+// Write-ahead log of routed chat messages.
+//
+// Every broadcast, private and group message is appended as one binary record to a log
+// of fixed-size segment files (<dir>/<id>.seg). Senders only encode the record into an
+// in-memory batch; a dedicated writer thread swaps the batch out, writes it with one
+// pwrite() per segment it touches and makes it durable with a single fdatasync() - a
+// group commit covering everything that arrived since the previous one. If the disk
+// falls too far behind, new records are dropped (and counted) rather than blocking
+// the fan-out path.
+//
+// Segments are preallocated and memory-mapped read-only, so /history reads records
+// straight from the page cache. An in-memory index keeps the positions of the most
+// recent records of every group; it is rebuilt by scanning the segments on startup.
+//
+// Record layout (little-endian, LOG_HEADER_SIZE bytes of header then the strings):
+//   u32 length (header + strings)   u32 checksum (FNV-1a of everything after it)
+//   u64 sequence number             u64 wall-clock time in ns
+//   u8 kind   u8 unused   u16 sender length   u16 target length   u16 unused
+//   sender, target (recipient or group name, empty for broadcasts), text
+// A zero length marks the unused, preallocated tail of a segment.
+
+#ifndef MESSAGE_LOG_H
+#define MESSAGE_LOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "metrics.h"
+#include "state_store.h"
+
+#define LOG_HEADER_SIZE 32
+#define LOG_HISTORY_KEEP 100 // Indexed records per group, the most /history can return
+
+enum class LogKind : uint8_t { BROADCAST = 1, PRIVATE = 2, GROUP = 3 };
+
+struct LogRecord {
+    uint64_t seq;
+    uint64_t time_ns;
+    LogKind kind;
+    std::string_view sender;
+    std::string_view target;
+    std::string_view text;
+};
+
+class MessageLog {
+public:
+    struct Options {
+        std::string dir;
+        size_t segment_bytes = 64 << 20;
+        size_t max_segments = 16;      // Oldest segments are deleted beyond this
+        size_t max_pending = 16 << 20; // Encoded bytes waiting for the writer before records are dropped
+    };
+
+    struct Stats {
+        Counter records;
+        Counter bytes;
+        Counter commits;  // Batches made durable with one fdatasync()
+        Counter dropped;  // Records refused because the writer fell behind
+        Histogram commit_ns;
+    };
+
+    explicit MessageLog(Options options) : options_(std::move(options)) {}
+
+    // Recover the existing segments, start a fresh one and the writer thread
+    bool open() {
+        if (mkdir(options_.dir.c_str(), 0755) < 0 && errno != EEXIST) {
+            perror("Message log directory");
+            return false;
+        }
+        if (!recover() || !rotate()) return false;
+        std::thread(&MessageLog::run, this).detach();
+        return true;
+    }
+
+    // Queue one routed message. Never waits for the disk.
+    void append(LogKind kind, std::string_view sender, std::string_view target, std::string_view text) {
+        sender = sender.substr(0, UINT16_MAX);
+        target = target.substr(0, UINT16_MAX);
+        uint32_t length = static_cast<uint32_t>(LOG_HEADER_SIZE + sender.size() + target.size() + text.size());
+        uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+
+        // Encode outside the lock, which then only covers one copy
+        thread_local std::string scratch;
+        scratch.resize(length);
+        char* p = scratch.data();
+        put(p, length);
+        put(p + 8, next_seq_.fetch_add(1, std::memory_order_relaxed));
+        put(p + 16, now);
+        p[24] = static_cast<char>(kind);
+        p[25] = 0;
+        put(p + 26, uint16_t(sender.size()));
+        put(p + 28, uint16_t(target.size()));
+        put(p + 30, uint16_t(0));
+        std::memcpy(p + LOG_HEADER_SIZE, sender.data(), sender.size());
+        std::memcpy(p + LOG_HEADER_SIZE + sender.size(), target.data(), target.size());
+        std::memcpy(p + LOG_HEADER_SIZE + sender.size() + target.size(), text.data(), text.size());
+        put(p + 4, checksum(p + 8, length - 8));
+
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (pending_.size() + length > options_.max_pending) {
+                stats_.dropped.add();
+                return;
+            }
+            pending_.append(scratch);
+        }
+        ready_.notify_one();
+    }
+
+    // Wait until everything appended so far has been written and committed (shutdown)
+    void sync() {
+        std::unique_lock<std::mutex> lock(mtx_);
+        idle_.wait(lock, [&] { return pending_.empty() && !writing_; });
+    }
+
+    // Call f(const LogRecord&) for up to n of the group's latest records, oldest first
+    template <typename F>
+    size_t history(std::string_view group, size_t n, F&& f) const {
+        std::vector<Position> positions;
+        index_.visit(group, [&](const std::deque<Position>& recent) {
+            size_t count = std::min(n, recent.size());
+            positions.assign(recent.end() - count, recent.end());
+        });
+
+        size_t served = 0;
+        for (const Position& pos : positions) {
+            std::shared_ptr<const Segment> segment = find_segment(pos.segment);
+            if (!segment) continue; // Already rotated out
+            LogRecord record;
+            if (decode(segment->map + pos.offset, segment->size - pos.offset, record)) {
+                f(record);
+                ++served;
+            }
+        }
+        return served;
+    }
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Segment {
+        Segment(uint64_t id, std::string path, int fd, const char* map, size_t size)
+            : id(id), path(std::move(path)), fd(fd), map(map), size(size) {}
+        ~Segment() {
+            munmap(const_cast<char*>(map), size);
+            close(fd);
+        }
+
+        uint64_t id;
+        std::string path;
+        int fd;
+        const char* map; // Read-only view of the whole file
+        size_t size;
+    };
+
+    struct Position {
+        uint64_t segment;
+        size_t offset;
+    };
+
+    template <typename T>
+    static void put(char* p, T value) { std::memcpy(p, &value, sizeof(value)); }
+
+    template <typename T>
+    static T get(const char* p) {
+        T value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static uint32_t checksum(const char* data, size_t len) {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < len; ++i) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+        }
+        return hash;
+    }
+
+    // Parse the record at p, false at the end of the written part or on a torn record
+    static bool decode(const char* p, size_t room, LogRecord& record) {
+        if (room < LOG_HEADER_SIZE) return false;
+        uint32_t length = get<uint32_t>(p);
+        if (length < LOG_HEADER_SIZE || length > room) return false;
+        if (get<uint32_t>(p + 4) != checksum(p + 8, length - 8)) return false;
+
+        size_t sender_len = get<uint16_t>(p + 26);
+        size_t target_len = get<uint16_t>(p + 28);
+        if (LOG_HEADER_SIZE + sender_len + target_len > length) return false;
+
+        record.seq = get<uint64_t>(p + 8);
+        record.time_ns = get<uint64_t>(p + 16);
+        record.kind = static_cast<LogKind>(p[24]);
+        record.sender = std::string_view(p + LOG_HEADER_SIZE, sender_len);
+        record.target = std::string_view(p + LOG_HEADER_SIZE + sender_len, target_len);
+        record.text = std::string_view(p + LOG_HEADER_SIZE + sender_len + target_len,
+                                       length - LOG_HEADER_SIZE - sender_len - target_len);
+        return true;
+    }
+
+    std::string segment_path(uint64_t id) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llu.seg", static_cast<unsigned long long>(id));
+        return options_.dir + name;
+    }
+
+    std::shared_ptr<const Segment> find_segment(uint64_t id) const {
+        std::shared_lock<std::shared_mutex> lock(segments_mtx_);
+        auto it = segments_.find(id);
+        return it == segments_.end() ? nullptr : it->second;
+    }
+
+    // Map an open segment file read-only
+    static std::shared_ptr<Segment> map_segment(uint64_t id, std::string path, int fd, size_t size) {
+        void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            close(fd);
+            return nullptr;
+        }
+        return std::make_shared<Segment>(id, std::move(path), fd, static_cast<const char*>(map), size);
+    }
+
+    // Remember where the latest records of each group live
+    void index_record(const LogRecord& record, uint64_t segment, size_t offset) {
+        if (record.kind != LogKind::GROUP) return;
+        Position pos{segment, offset};
+        auto add = [&](std::deque<Position>& recent) {
+            recent.push_back(pos);
+            if (recent.size() > LOG_HISTORY_KEEP) recent.pop_front();
+        };
+        // Only the writer thread (or open(), before it starts) adds to the index
+        if (!index_.update(record.target, add)) {
+            index_.insert(std::string(record.target), std::deque<Position>(1, pos));
+        }
+    }
+
+    // Scan the segments left by a previous run, rebuilding the index and the sequence number
+    bool recover() {
+        DIR* dir = opendir(options_.dir.c_str());
+        if (!dir) {
+            perror("Message log directory");
+            return false;
+        }
+        std::vector<uint64_t> ids;
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() == 20 && name.compare(16, 4, ".seg") == 0) {
+                ids.push_back(std::strtoull(name.c_str(), nullptr, 10));
+            }
+        }
+        closedir(dir);
+        std::sort(ids.begin(), ids.end());
+
+        size_t recovered = 0;
+        for (uint64_t id : ids) {
+            std::string path = segment_path(id);
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+                if (fd >= 0) close(fd);
+                continue;
+            }
+            std::shared_ptr<Segment> segment = map_segment(id, path, fd, st.st_size);
+            if (!segment) continue;
+
+            size_t offset = 0;
+            LogRecord record;
+            while (decode(segment->map + offset, segment->size - offset, record)) {
+                index_record(record, id, offset);
+                next_seq_ = std::max<uint64_t>(next_seq_, record.seq + 1);
+                offset += get<uint32_t>(segment->map + offset);
+                ++recovered;
+            }
+            segments_[id] = std::move(segment);
+            next_id_ = id + 1;
+        }
+        trim_segments();
+
+        if (recovered > 0) {
+            std::cout << "Recovered " << recovered << " logged messages from " << options_.dir << std::endl;
+        }
+        return true;
+    }
+
+    // Start writing to a new, preallocated segment
+    bool rotate() {
+        if (fd_ >= 0) {
+            fdatasync(fd_);
+            close(fd_);
+            fd_ = -1;
+        }
+
+        uint64_t id = next_id_++;
+        std::string path = segment_path(id);
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || ftruncate(fd, options_.segment_bytes) < 0) {
+            perror("Message log segment");
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        int read_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        std::shared_ptr<Segment> segment = read_fd < 0 ? nullptr : map_segment(id, path, read_fd, options_.segment_bytes);
+        if (!segment) {
+            close(fd);
+            return false;
+        }
+
+        fd_ = fd;
+        segment_id_ = id;
+        tail_ = 0;
+        {
+            std::unique_lock<std::shared_mutex> lock(segments_mtx_);
+            segments_[id] = std::move(segment);
+        }
+        trim_segments();
+        return true;
+    }
+
+    void trim_segments() {
+        std::unique_lock<std::shared_mutex> lock(segments_mtx_);
+        while (segments_.size() > options_.max_segments) {
+            unlink(segments_.begin()->second->path.c_str()); // Readers still holding it keep the mapping
+            segments_.erase(segments_.begin());
+        }
+    }
+
+    // Write one run of whole records at the tail of the current segment
+    bool write_run(const char* data, size_t len) {
+        for (size_t done = 0; done < len; ) {
+            ssize_t n = pwrite(fd_, data + done, len - done, tail_ + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                perror("Message log write");
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    // Writer thread: take everything queued, write it, commit it with one fdatasync()
+    void run() {
+        std::string batch;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                ready_.wait(lock, [&] { return !pending_.empty(); });
+                batch.swap(pending_);
+                writing_ = true;
+            }
+
+            uint64_t start = metrics_now_ns();
+            size_t run_start = 0;
+            size_t offset = 0;
+            size_t records = 0;
+            std::vector<std::pair<LogRecord, Position>> written;
+            bool ok = true;
+
+            while (ok && offset < batch.size()) {
+                size_t length = get<uint32_t>(batch.data() + offset);
+                if (tail_ + (offset - run_start) + length > options_.segment_bytes) {
+                    // Segment full: flush the run so far and continue in a new one
+                    ok = write_run(batch.data() + run_start, offset - run_start) && rotate();
+                    run_start = offset;
+                    continue;
+                }
+
+                LogRecord record;
+                decode(batch.data() + offset, length, record);
+                if (record.kind == LogKind::GROUP) {
+                    written.push_back({record, Position{segment_id_, tail_ + (offset - run_start)}});
+                }
+                offset += length;
+                ++records;
+            }
+            ok = ok && write_run(batch.data() + run_start, offset - run_start);
+            if (!ok) {
+                // Disk trouble, the batch is lost; the next one starts a fresh segment
+                stats_.dropped.add(records);
+                batch.clear();
+                if (fd_ < 0 || tail_ > 0) rotate();
+                done_writing();
+                continue;
+            }
+            tail_ += offset - run_start;
+            fdatasync(fd_);
+
+            // Records are readable from the mapping once written, publish them to /history
+            for (const auto& [record, pos] : written) {
+                index_record(record, pos.segment, pos.offset);
+            }
+
+            stats_.records.add(records);
+            stats_.bytes.add(batch.size());
+            stats_.commits.add();
+            stats_.commit_ns.record(metrics_now_ns() - start);
+            batch.clear();
+            done_writing();
+        }
+    }
+
+    void done_writing() {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            writing_ = false;
+        }
+        idle_.notify_all();
+    }
+
+    Options options_;
+
+    std::atomic<uint64_t> next_seq_{1};
+    std::mutex mtx_; // Guards pending_ and writing_
+    std::condition_variable ready_;
+    std::condition_variable idle_; // Signalled when a batch is done, for sync()
+    std::string pending_;
+    bool writing_ = false; // The writer thread holds a batch
+
+    // Writer thread state
+    int fd_ = -1;
+    uint64_t segment_id_ = 0;
+    uint64_t next_id_ = 1;
+    size_t tail_ = 0;
+
+    mutable std::shared_mutex segments_mtx_;
+    std::map<uint64_t, std::shared_ptr<const Segment>> segments_;
+    ShardedMap<std::string, std::deque<Position>> index_; // Group -> latest positions
+
+    Stats stats_;
+};
+
+#endif // MESSAGE_LOG_H
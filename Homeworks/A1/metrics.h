@@ -0,0 +1,160 @@
+// Lock-free metrics primitives for the chat server.
+//
+// Counters and histograms are striped: each thread updates its own cache-line padded
+// slot with relaxed atomics, and readers sum the slots when the metrics are scraped.
+// Histograms use HDR-style log-linear buckets (8 linear sub-buckets per power of two,
+// so any recorded value is reported within 12.5%) and cover the full 64-bit range.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#define METRICS_STRIPES 8
+#define HIST_SUB_BITS 3
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+// Stripe owned by the calling thread, handed out round-robin on first use
+inline unsigned metrics_stripe() {
+    static std::atomic<unsigned> next{0};
+    thread_local unsigned stripe = next.fetch_add(1, std::memory_order_relaxed) % METRICS_STRIPES;
+    return stripe;
+}
+
+inline uint64_t metrics_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        slots_[metrics_stripe()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t total = 0;
+        for (const Slot& s : slots_) total += s.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Slot, METRICS_STRIPES> slots_;
+};
+
+// Up/down value such as the number of open connections
+class Gauge {
+public:
+    void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+class Histogram {
+public:
+    void record(uint64_t v) {
+        Stripe& s = stripes_[metrics_stripe()];
+        s.buckets[bucket_of(v)].fetch_add(1, std::memory_order_relaxed);
+        s.count.fetch_add(1, std::memory_order_relaxed);
+        s.sum.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    // Merged view of all stripes at one point in time
+    struct Snapshot {
+        std::array<uint64_t, HIST_BUCKETS> buckets{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+
+        // Upper bound of the bucket holding the q-th quantile
+        uint64_t quantile(double q) const {
+            if (count == 0) return 0;
+            uint64_t rank = static_cast<uint64_t>(q * (count - 1)) + 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < HIST_BUCKETS; ++i) {
+                seen += buckets[i];
+                if (seen >= rank) return upper_bound_of(i);
+            }
+            return upper_bound_of(HIST_BUCKETS - 1);
+        }
+    };
+
+    Snapshot snapshot() const {
+        Snapshot snap;
+        for (const Stripe& s : stripes_) {
+            for (size_t i = 0; i < HIST_BUCKETS; ++i) snap.buckets[i] += s.buckets[i].load(std::memory_order_relaxed);
+            snap.count += s.count.load(std::memory_order_relaxed);
+            snap.sum += s.sum.load(std::memory_order_relaxed);
+        }
+        return snap;
+    }
+
+    static size_t bucket_of(uint64_t v) {
+        if (v < HIST_SUB_BUCKETS) return v;
+        int e = 63 - __builtin_clzll(v);
+        return (e - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+    }
+
+    static uint64_t upper_bound_of(size_t i) {
+        if (i < HIST_SUB_BUCKETS) return i;
+        int e = int(i / HIST_SUB_BUCKETS) + HIST_SUB_BITS - 1;
+        uint64_t width = uint64_t(1) << (e - HIST_SUB_BITS);
+        return (HIST_SUB_BUCKETS + i % HIST_SUB_BUCKETS) * width + (width - 1);
+    }
+
+private:
+    struct alignas(64) Stripe {
+        std::array<std::atomic<uint64_t>, HIST_BUCKETS> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+    };
+    std::array<Stripe, METRICS_STRIPES> stripes_;
+};
+
+// Records the lifetime of the scope, in nanoseconds, into a histogram
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& hist) : hist_(hist), start_(metrics_now_ns()) {}
+    ~ScopedTimer() { hist_.record(metrics_now_ns() - start_); }
+
+private:
+    Histogram& hist_;
+    uint64_t start_;
+};
+
+// Prometheus text exposition helpers. Histograms of nanoseconds are exported as
+// summaries in seconds with a fixed set of quantiles.
+
+template <typename T>
+void write_metric(std::ostringstream& out, const std::string& name, const char* type,
+                  const std::string& labels, T value, bool header = true) {
+    if (header) out << "# TYPE " << name << " " << type << "\n";
+    out << name;
+    if (!labels.empty()) out << "{" << labels << "}";
+    out << " " << value << "\n";
+}
+
+inline void write_summary_ns(std::ostringstream& out, const std::string& name, const std::string& labels,
+                             const Histogram& hist, bool header = true) {
+    Histogram::Snapshot snap = hist.snapshot();
+    if (header) out << "# TYPE " << name << " summary\n";
+    std::string sep = labels.empty() ? "" : labels + ",";
+    for (double q : {0.5, 0.9, 0.99, 0.999}) {
+        out << name << "{" << sep << "quantile=\"" << q << "\"} " << snap.quantile(q) * 1e-9 << "\n";
+    }
+    std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+    out << name << "_sum" << suffix << " " << snap.sum * 1e-9 << "\n";
+    out << name << "_count" << suffix << " " << snap.count << "\n";
+}
+
+#endif // METRICS_H
@@ -0,0 +1,320 @@
+// Bounded per-connection outbound queue.
+//
+// Senders never block on a peer: push() writes straight to the socket when nothing is
+// queued, otherwise the frame waits in the queue and the I/O layer drains it with
+// flush() once the socket is writable, sending up to OUTBOUND_MAX_IOV frames per
+// syscall. Queued frames are shared Payloads, so a fan-out queues references rather
+// than copies. When a queue is full the configured slow-consumer policy decides what to do,
+// except for control frames (the binary protocol's ID -> name frames), which are always
+// queued and never evicted: the client would otherwise never learn the name.
+//
+// In io_uring mode the event loop owning the connection can instead defer its own pushes:
+// it takes the frames with prepare(), submits the send itself and reports the result with
+// complete(), so a fan-out on the loop becomes one batch of submissions instead of a syscall each.
+
+#ifndef OUTBOUND_H
+#define OUTBOUND_H
+
+#include <cerrno>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "payload.h"
+
+#define OUTBOUND_MAX_IOV 64
+
+enum class SlowConsumerPolicy {
+    DROP,       // Discard new messages while the queue is full
+    DISCONNECT, // Shut the connection down
+    COALESCE,   // Discard the oldest unsent messages and tell the client how many it missed
+};
+
+// Totals across every queue that shares them
+struct OutboundStats {
+    Counter bytes_out;
+    Counter writes;  // send()/sendmsg() calls that moved bytes
+    Counter dropped; // Messages discarded by DROP and COALESCE
+    Counter disconnects;
+};
+
+struct OutboundLimits {
+    size_t max_bytes = 1 << 20;
+    SlowConsumerPolicy policy = SlowConsumerPolicy::DROP;
+};
+
+class OutboundQueue {
+public:
+    OutboundQueue(int fd, const OutboundLimits& limits, OutboundStats& stats) : fd_(fd), limits_(limits), stats_(stats) {}
+
+    // The connection switched to the binary protocol: notices go out as binary TEXT frames
+    void set_binary() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        binary_ = true;
+    }
+
+    // Queue one encoded frame and write as much as the socket accepts right away, unless defer is set.
+    // A control frame bypasses the slow-consumer policy.
+    // Returns true when bytes were left behind on a queue that was empty, i.e. the
+    // caller must make sure the I/O layer will call flush() when the socket drains
+    // (or, in io_uring mode, send with prepare()).
+    bool push(Payload frame, bool defer = false, bool control = false) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (closed_ || broken_ || finished_) return false;
+
+        if (defer && in_flight_.empty() && queued_bytes_ + frame->size() > limits_.max_bytes) {
+            // Only slow if the socket won't take what was deferred, so try it before applying the policy
+            drain();
+            if (closed_ || broken_) return false;
+        }
+
+        bool idle = frames_.empty() && in_flight_.empty();
+        if (idle && defer) {
+            queued_bytes_ += frame->size();
+            frames_.push_back({std::move(frame), control});
+            return true;
+        }
+        if (idle) {
+            size_t written = write_some(frame->data(), frame->size());
+            if (broken_ || written == frame->size()) return false;
+            queued_bytes_ = frame->size() - written;
+            head_offset_ = written;
+            frames_.push_back({std::move(frame), control});
+            return true;
+        }
+
+        if (!control && queued_bytes_ + frame->size() > limits_.max_bytes && !make_room(frame->size())) {
+            return false;
+        }
+        queued_bytes_ += frame->size();
+        frames_.push_back({std::move(frame), control});
+        return false; // Already pending, a flush is on its way
+    }
+
+    // io_uring mode: move up to max queued frames in flight and describe them in iov.
+    // Returns the iovec count, 0 when there is nothing to send or a send is still in flight.
+    int prepare(iovec* iov, int max) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (closed_ || broken_ || !in_flight_.empty()) return 0;
+
+        if (skipped_ > 0 && head_offset_ == 0) {
+            queue_skipped_notice();
+        }
+
+        int count = 0;
+        while (!frames_.empty() && count < max) {
+            size_t offset = (count == 0) ? head_offset_ : 0;
+            iov[count].iov_base = const_cast<char*>(frames_.front().data->data() + offset);
+            iov[count].iov_len = frames_.front().data->size() - offset;
+            in_flight_.push_back(std::move(frames_.front()));
+            frames_.pop_front();
+            ++count;
+        }
+        return count;
+    }
+
+    // The send of the frames from prepare() finished with result (bytes sent or -errno).
+    // Unsent frames go back to the front of the queue. Returns true while bytes are still pending.
+    bool complete(ssize_t result) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (result < 0 && result != -EAGAIN && result != -EINTR) {
+            in_flight_.clear();
+            mark_broken();
+            return false;
+        }
+        if (result > 0) {
+            stats_.writes.add();
+            stats_.bytes_out.add(result);
+        }
+
+        // consume() works on frames_, so put the in-flight frames back in front first
+        frames_.insert(frames_.begin(), std::make_move_iterator(in_flight_.begin()), std::make_move_iterator(in_flight_.end()));
+        in_flight_.clear();
+        if (result > 0) consume(result);
+        return !frames_.empty() && !closed_ && !broken_;
+    }
+
+    // Drain queued frames with vectored writes until the socket would block.
+    // Returns true while bytes are still pending.
+    bool flush() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (closed_ || broken_) return false;
+        return drain();
+    }
+
+    bool pending() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return (!frames_.empty() || !in_flight_.empty()) && !closed_ && !broken_;
+    }
+
+    // Messages discarded by the DROP and COALESCE policies
+    size_t dropped() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return dropped_;
+    }
+
+    // Graceful shutdown: once everything queued has been sent, half-close the connection so the
+    // client reads the rest and then EOF. Later frames are dropped. Returns true once done.
+    bool finish() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (closed_ || broken_ || finished_) return true;
+        if (!frames_.empty() || !in_flight_.empty() || skipped_ > 0) return false;
+        finished_ = true;
+        ::shutdown(fd_, SHUT_WR);
+        return true;
+    }
+
+    // Close the socket. Taken under the queue lock so no sender writes to a reused fd.
+    void close_socket() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (closed_) return;
+        closed_ = true;
+        frames_.clear();
+        ::close(fd_);
+    }
+
+private:
+    struct Frame {
+        Payload data;
+        bool control; // Exempt from the slow-consumer policy
+    };
+
+    // At a frame boundary, tell the client how many messages the coalescing dropped, in its protocol
+    void queue_skipped_notice() {
+        std::string text = "[" + std::to_string(skipped_) + " messages skipped, connection too slow]";
+        Payload notice = binary_ ? make_binary_payload(BinaryOp::TEXT, 0, 0, {text}) : make_payload(text);
+        queued_bytes_ += notice->size();
+        frames_.push_front({std::move(notice), true});
+        skipped_ = 0;
+    }
+
+    // flush() under the lock
+    bool drain() {
+        while (!frames_.empty() || skipped_ > 0) {
+            if (skipped_ > 0 && head_offset_ == 0) {
+                queue_skipped_notice();
+            }
+
+            iovec iov[OUTBOUND_MAX_IOV];
+            int count = 0;
+            for (auto it = frames_.begin(); it != frames_.end() && count < OUTBOUND_MAX_IOV; ++it, ++count) {
+                size_t offset = (count == 0) ? head_offset_ : 0;
+                iov[count].iov_base = const_cast<char*>(it->data->data() + offset);
+                iov[count].iov_len = it->data->size() - offset;
+            }
+
+            // sendmsg() is writev() with flags: MSG_DONTWAIT keeps blocking sockets non-blocking here
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            ssize_t n = sendmsg(fd_, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+                mark_broken();
+                return false;
+            }
+            stats_.writes.add();
+            stats_.bytes_out.add(n);
+            consume(n);
+        }
+        return false;
+    }
+
+    size_t write_some(const char* data, size_t len) {
+        size_t written = 0;
+        while (written < len) {
+            ssize_t n = send(fd_, data + written, len - written, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                written += n;
+                stats_.writes.add();
+                stats_.bytes_out.add(n);
+            }
+            else if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            else {
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) mark_broken();
+                break;
+            }
+        }
+        return written;
+    }
+
+    // Drop n written bytes from the front of the queue
+    void consume(size_t n) {
+        queued_bytes_ -= n;
+        while (n > 0) {
+            size_t left = frames_.front().data->size() - head_offset_;
+            if (n < left) {
+                head_offset_ += n;
+                return;
+            }
+            n -= left;
+            head_offset_ = 0;
+            frames_.pop_front();
+        }
+    }
+
+    // Apply the slow-consumer policy, returns true if the new frame may be queued
+    bool make_room(size_t incoming) {
+        switch (limits_.policy) {
+        case SlowConsumerPolicy::DROP:
+            ++dropped_;
+            stats_.dropped.add();
+            return false;
+
+        case SlowConsumerPolicy::DISCONNECT:
+            stats_.disconnects.add();
+            mark_broken();
+            shutdown(fd_, SHUT_RDWR); // The connection's reader sees EOF and cleans up
+            return false;
+
+        case SlowConsumerPolicy::COALESCE: {
+            // Never evict the front frame once part of it is on the wire, nor a control frame
+            auto first = frames_.begin() + (head_offset_ > 0 ? 1 : 0);
+            while (first != frames_.end() && queued_bytes_ + incoming > limits_.max_bytes) {
+                if (first->control) {
+                    ++first;
+                    continue;
+                }
+                queued_bytes_ -= first->data->size();
+                first = frames_.erase(first);
+                ++skipped_;
+                ++dropped_;
+                stats_.dropped.add();
+            }
+            return true;
+        }
+        }
+        return false;
+    }
+
+    void mark_broken() {
+        broken_ = true;
+        frames_.clear();
+        queued_bytes_ = 0;
+        head_offset_ = 0;
+    }
+
+    int fd_;
+    const OutboundLimits& limits_;
+    OutboundStats& stats_;
+
+    mutable std::mutex mtx_;
+    std::deque<Frame> frames_;       // Encoded frames, the front one possibly half written
+    std::deque<Frame> in_flight_;    // io_uring mode: frames the kernel is sending, taken off frames_
+    size_t head_offset_ = 0;         // Bytes of frames_.front() already sent
+    size_t queued_bytes_ = 0;
+    size_t skipped_ = 0;             // Coalesced messages not yet reported to the client
+    size_t dropped_ = 0;
+    bool broken_ = false;            // Write failed or the connection was shut down
+    bool closed_ = false;
+    bool finished_ = false;          // Half-closed by finish()
+    bool binary_ = false;            // Notices are encoded for the binary protocol
+};
+
+#endif // OUTBOUND_H
@@ -0,0 +1,67 @@
+// Immutable, reference-counted message payloads for fan-out.
+//
+// A broadcast or group message is serialized into one encoded frame exactly once;
+// every recipient's outbound queue holds a reference to that same buffer, so sending
+// to N users costs one allocation and one copy instead of N.
+
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "binary_protocol.h"
+#include "framing.h"
+#include "metrics.h"
+
+using Payload = std::shared_ptr<const std::string>;
+
+// Process-wide counters
+struct PayloadStats {
+    Counter allocations; // Payloads built
+    Counter bytes;       // Encoded bytes across all payloads
+    Counter deliveries;  // References handed to outbound queues
+};
+
+inline PayloadStats payload_stats;
+
+// Encode the concatenation of parts as one frame in a single buffer. Text past MAX_FRAME_SIZE
+// is cut off, a longer frame would make every client reading it drop the connection.
+inline Payload make_payload(std::initializer_list<std::string_view> parts) {
+    size_t len = std::min<size_t>(parts_size(parts), MAX_FRAME_SIZE);
+
+    std::string frame;
+    frame.reserve(FRAME_HEADER_SIZE + len);
+    append_frame(frame, std::string_view()); // Header placeholder, patched below
+    append_parts(frame, parts, len);
+
+    uint32_t n = static_cast<uint32_t>(len);
+    frame[0] = static_cast<char>((n >> 24) & 0xff);
+    frame[1] = static_cast<char>((n >> 16) & 0xff);
+    frame[2] = static_cast<char>((n >> 8) & 0xff);
+    frame[3] = static_cast<char>(n & 0xff);
+
+    payload_stats.allocations.add();
+    payload_stats.bytes.add(frame.size());
+    return std::make_shared<const std::string>(std::move(frame));
+}
+
+inline Payload make_payload(std::string_view text) {
+    return make_payload({text});
+}
+
+// Encode a binary-protocol frame (binary_protocol.h) whose body is the concatenation of parts
+inline Payload make_binary_payload(BinaryOp op, uint32_t id0, uint32_t id1, std::initializer_list<std::string_view> parts) {
+    std::string frame;
+    append_binary(frame, op, id0, id1, parts);
+
+    payload_stats.allocations.add();
+    payload_stats.bytes.add(frame.size());
+    return std::make_shared<const std::string>(std::move(frame));
+}
+
+#endif // PAYLOAD_H
@@ -0,0 +1,174 @@
+// Token-bucket rate limits for the chat server, per user and per group.
+//
+// Buckets are indexed by the interned user or group ID. Each one is a single atomic word
+// holding the bucket's "theoretical arrival time" (the GCRA form of a token bucket): a
+// message is allowed when, one emission interval later, that time is still at most
+// burst - 1 intervals ahead of now. A check is a clock read and one compare-and-swap,
+// with no lock and no allocation; a rejected message leaves the bucket untouched.
+//
+// The limits file has one rule per line, "*" being the default for its scope:
+//
+//   # scope  name   messages/s  burst
+//   user     *      20          40
+//   user     bot    200         400
+//   group    *      100         200
+//   group    lobby  0           0       (0 messages/s = unlimited)
+//
+// It is read at startup and reloaded on SIGHUP; a reload re-applies the rules to every
+// existing bucket, keeping what each one has used so far.
+
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "metrics.h"
+
+#define RATE_CHUNK_BITS 12
+#define RATE_CHUNKS 1024 // Up to 4M IDs per scope
+
+struct RateLimit {
+    double rate = 0;    // Messages per second, 0 = unlimited
+    uint32_t burst = 1; // Messages allowed back to back
+};
+
+// Rules of one scope (users or groups)
+struct RateRules {
+    RateLimit fallback; // For names without a rule of their own
+    std::unordered_map<std::string, RateLimit> named;
+
+    const RateLimit& find(std::string_view name) const {
+        auto it = named.find(std::string(name));
+        return it == named.end() ? fallback : it->second;
+    }
+};
+
+class RateLimiter {
+public:
+    RateLimiter() = default;
+    ~RateLimiter() {
+        for (auto& chunk : chunks_) delete chunk.load(std::memory_order_relaxed);
+    }
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // Give bucket id the limit the rules set for name (at login, at group creation).
+    // IDs past the last chunk have no bucket and stay unlimited, as allow() treats them.
+    void assign(uint32_t id, std::string_view name) {
+        if (!in_range(id)) return;
+        std::lock_guard<std::mutex> lock(mtx_);
+        apply(bucket(id), rules_.find(name));
+        end_ = std::max(end_, id + 1);
+    }
+
+    // Replace the rules and re-apply them to every bucket, name_of(id) giving each bucket's name
+    template <typename F>
+    void configure(RateRules rules, F&& name_of) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        rules_ = std::move(rules);
+        for (uint32_t id = 0; id < end_; ++id) {
+            std::string_view name = name_of(id);
+            if (!name.empty()) apply(bucket(id), rules_.find(name));
+        }
+    }
+
+    // Take one message from bucket id, false when it is over its limit
+    bool allow(uint32_t id, uint64_t now = metrics_now_ns()) {
+        if (!in_range(id)) return true;
+        Chunk* chunk = chunks_[id >> RATE_CHUNK_BITS].load(std::memory_order_acquire);
+        if (!chunk) return true; // Never assigned
+        Bucket& b = (*chunk)[id & CHUNK_MASK];
+
+        uint64_t interval = b.interval.load(std::memory_order_relaxed);
+        if (interval == 0) return true;
+        uint64_t tolerance = b.tolerance.load(std::memory_order_relaxed);
+        uint64_t tat = b.tat.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            uint64_t start = std::max(tat, now);
+            if (start - now > tolerance) return false;
+            next = start + interval;
+        } while (!b.tat.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+        return true;
+    }
+
+private:
+    static constexpr uint32_t CHUNK_MASK = (1u << RATE_CHUNK_BITS) - 1;
+
+    struct Bucket {
+        std::atomic<uint64_t> tat{0};       // Theoretical arrival time of the next message, steady clock ns
+        std::atomic<uint64_t> interval{0};  // ns per message, 0 = unlimited
+        std::atomic<uint64_t> tolerance{0}; // How far tat may run ahead of now: (burst - 1) intervals
+    };
+    using Chunk = std::array<Bucket, size_t(1) << RATE_CHUNK_BITS>;
+
+    static bool in_range(uint32_t id) { return (id >> RATE_CHUNK_BITS) < RATE_CHUNKS; }
+
+    // Under mtx_, id in_range()
+    Bucket& bucket(uint32_t id) {
+        std::atomic<Chunk*>& entry = chunks_[id >> RATE_CHUNK_BITS];
+        Chunk* chunk = entry.load(std::memory_order_relaxed);
+        if (!chunk) {
+            chunk = new Chunk();
+            entry.store(chunk, std::memory_order_release);
+        }
+        return (*chunk)[id & CHUNK_MASK];
+    }
+
+    static void apply(Bucket& b, const RateLimit& limit) {
+        uint64_t interval = limit.rate > 0 ? std::max<uint64_t>(1, uint64_t(1e9 / limit.rate)) : 0;
+        b.interval.store(interval, std::memory_order_relaxed);
+        b.tolerance.store(interval * (std::max<uint32_t>(limit.burst, 1) - 1), std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<Chunk*>, RATE_CHUNKS> chunks_{};
+    std::mutex mtx_; // Serialises assign() and configure()
+    RateRules rules_;
+    uint32_t end_ = 0; // One past the highest assigned ID
+};
+
+// Parse a limits file into user and group rules. Returns false (naming the bad line) on error.
+inline bool load_rate_rules(const std::string& path, RateRules& users, RateRules& groups) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Could not open rate limit file " << path << std::endl;
+        return false;
+    }
+
+    RateRules next_users, next_groups;
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); ++number) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream iss(line);
+        std::string scope, name;
+        RateLimit limit;
+        if (!(iss >> scope)) continue; // Blank or comment
+
+        std::string extra;
+        if (!(iss >> name >> limit.rate >> limit.burst) || (iss >> extra) || limit.rate < 0 ||
+            (scope != "user" && scope != "group")) {
+            std::cerr << path << ":" << number << ": expected \"user|group <name|*> <messages/s> <burst>\"" << std::endl;
+            return false;
+        }
+        RateRules& rules = scope == "user" ? next_users : next_groups;
+        if (name == "*") rules.fallback = limit;
+        else rules.named[name] = limit;
+    }
+
+    users = std::move(next_users);
+    groups = std::move(next_groups);
+    return true;
+}
+
+#endif // RATE_LIMIT_H
@@ -2,355 +2,905 @@
 #include <thread>
 #include <mutex>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
+#include <memory>
 #include <sstream>
-#include <fstream>
 #include <cstring>
 #include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <climits>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <csignal>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 
+#include "binary_protocol.h"
+#include "command.h"
+#include "credentials.h"
+#include "framing.h"
+#include "mailbox.h"
+#include "message_log.h"
+#include "metrics.h"
+#include "outbound.h"
+#include "rate_limit.h"
+#include "state_store.h"
+#include "worker_pool.h"
+#ifdef CHAT_IO_URING
+#include "uring.h"
+#endif
+
 
 
 #define PORT 12345
-#define BUFFER_SIZE 1024
+#define LISTEN_BACKLOG 4096 // Per listening socket, the kernel caps it at net.core.somaxconn
+#define MAX_EVENTS 256
+#define METRICS_PORT 9100
+#define WORKER_QUEUE_DEPTH 1024
+#define URING_ENTRIES 1024
+#define URING_BUFFERS 1024     // Provided receive buffers per io_uring loop, a power of two
+#define URING_BUFFER_SIZE 4096
+#define URING_STALL_RETRY_NS 1000000 // How soon a loop retries sessions whose worker queue was full
+#define DRAIN_TIMEOUT_S 10     // Graceful shutdown: how long clients get to receive their queued output
+#define RECONNECT_SPREAD_S 10  // Reconnect hints ask for a delay of 1..N seconds
+#define STOP_POLL_MS 10        // How often the loops and the drain check on each other while stopping
+#define HANDOFF_MAX_FDS 253    // SCM_MAX_FD, descriptors per SCM_RIGHTS message
+
+
+
+// Server-wide metrics, updated without locks from every thread and rendered on scrape
+
+    struct ServerMetrics {
+        std::array<Counter, NUM_COMMANDS> commands; // Indexed by CommandType
+        Counter bytes_in;
+        Counter logins;
+        Counter auth_failures;
+        Counter binary_logins; // Logins that negotiated the binary protocol
+        Gauge connections;
+
+        // Time spent waiting on contended shard locks, per store
+        Histogram groups_lock_wait;
+
+        // Time to hand one message to every recipient's queue
+        Histogram broadcast_fanout;
+        Histogram group_fanout;
+
+        // Messages turned away by the rate limits, before any fan-out
+        std::array<Counter, NUM_COMMANDS> user_rate_limited; // Indexed by CommandType
+        Counter group_rate_limited;
+    };
+
+    ServerMetrics server_metrics;
+    OutboundStats outbound_stats;
+
+
+
+#ifdef CHAT_IO_URING
+// io_uring mode: connections with output waiting, collected for the loop that owns them
+// so it can submit all their sends at once
+
+    IoRing::Stats uring_stats;
+
+    struct UringLoop {
+        std::mutex mtx;
+        std::vector<int> to_send;
+        std::atomic<bool> woken{false};
+        int wake_fd = -1; // eventfd the loop keeps a read posted on
+    };
 
+    thread_local UringLoop* current_loop = nullptr;
 
+    void uring_schedule(UringLoop& loop, int fd) {
+        {
+            std::lock_guard<std::mutex> lock(loop.mtx);
+            loop.to_send.push_back(fd);
+        }
+        // The loop itself picks the list up before it next waits, other threads wake it once per round
+        if (&loop != current_loop && !loop.woken.exchange(true)) {
+            eventfd_write(loop.wake_fd, 1);
+        }
+    }
+#endif
 
-std::mutex mtx; // Mutex for thread safety
-std::unordered_map<int, std::string> clients; // Socket -> Username
-std::unordered_map<std::string, int> user_sockets; // Username -> Socket
-std::unordered_map<std::string, std::unordered_set<std::string>> groups; // Group Name -> Members
-std::unordered_map<std::string, std::mutex> group_mutexes; // Group Name -> Mutex
+// An accepted client. Other threads only ever push to its outbound queue, the thread
+// or event loop that owns the connection does all reads and drains the queue.
 
+    OutboundLimits outbound_limits; // Queue size and slow-consumer policy, set once at startup
 
+    struct Connection {
+        explicit Connection(int fd) : socket(fd), out(fd, outbound_limits, outbound_stats) {}
 
-// Send message to a specific client
+        int socket;
+        int wake_fd = -1; // Thread mode: eventfd poked when output is left pending
+#ifdef CHAT_IO_URING
+        UringLoop* loop = nullptr; // io_uring mode: the loop that sends for this connection
+#endif
+        std::string username;
+        uint32_t user_id = 0; // Interned at login
+        uint32_t index = 0;   // Slot in connections, from login to close
+        OutboundQueue out;
+
+        // Binary protocol, chosen during login before the connection is visible to other threads
+        bool binary = false;
+        std::mutex names_mtx;
+        std::vector<bool> known_users, known_groups; // IDs whose names this client has been sent
+    };
+
+// Users get an ID at login and groups when they are created. The IDs index the tables
+// below and are the ones the binary protocol sends.
+InternTable user_ids;
+InternTable group_ids;
+
+// The logged-in connections, by dense connection index (for broadcasts) and by user ID
+SlotTable<Connection> connections;
+SlotAllocator connection_slots;
+SlotTable<Connection> online; // The latest login of each user
+GroupTable groups(&server_metrics.groups_lock_wait); // Group ID -> member user IDs
+
+// Graceful shutdown (SIGTERM, SIGINT, or a handoff to a new process): once stopping is set
+// nothing new is accepted, once stopped is set the drain is over and the loops return.
+// stop_fd is an eventfd that becomes readable when stopping starts, for the acceptors to watch.
+std::atomic<bool> stopping{false};
+std::atomic<bool> stopped{false};
+int stop_fd = -1;
+int drain_timeout_s = DRAIN_TIMEOUT_S;
+std::vector<int> listen_sockets;
+
+// Credentials from users.txt, loaded once at startup and reloaded when the file changes
+
+    std::unique_ptr<CredentialStore> credentials;
+
+// Messages kept for offline users, nullptr when --mailbox-bytes is 0
+
+    std::unique_ptr<MailboxStore> mailboxes;
+
+// Append-only log of every routed message, nullptr unless --log-dir is given
+
+    std::unique_ptr<MessageLog> message_log;
+
+// Token buckets per user and per group ID, nullptr unless --rate-limits is given
+
+    struct RateLimits {
+        std::string path;
+        RateLimiter users;
+        RateLimiter groups;
+    };
+
+    std::unique_ptr<RateLimits> rate_limits;
+
+    // (Re)read the limits file, existing buckets pick up the new rules. On failure the old rules stay.
+    bool reload_rate_limits() {
+        RateRules users, groups;
+        if (!load_rate_rules(rate_limits->path, users, groups)) return false;
+        rate_limits->users.configure(std::move(users), [](uint32_t id) { return user_ids.name(id); });
+        rate_limits->groups.configure(std::move(groups), [](uint32_t id) { return group_ids.name(id); });
+        std::cout << "Loaded rate limits from " << rate_limits->path << std::endl;
+        return true;
+    }
 
-    void send_message(int client_socket, const std::string& message) {
-        send(client_socket, message.c_str(), message.size(), 0);
+    void log_message(LogKind kind, std::string_view sender, std::string_view target, std::string_view text) {
+        if (message_log) {
+            message_log->append(kind, sender, target, text);
+        }
     }
 
-// Broadcast message to all clients
 
-    void broadcast_message(const std::string& message, int sender_socket) {
-        std::lock_guard<std::mutex> lock(mtx);
-        for (const auto& client : clients) {
-            if (client.first != sender_socket) {
-                // send_message(client.first, "[Broadcast] " + message);
-                send_message(client.first, message);
+
+// Server options chosen on the command line
+
+    enum class ServerMode { THREADS, REACTOR, URING };
+
+    struct ServerConfig {
+        ServerMode mode = ServerMode::THREADS;
+        unsigned loops = 0; // Reactor or io_uring event loops, 0 = one per core
+        unsigned listeners = 0; // Accepting threads in thread mode, 0 = one per core
+        int backlog = LISTEN_BACKLOG;
+        std::string users_file = "users.txt";
+        OutboundLimits outbound;
+        int metrics_port = METRICS_PORT; // 0 = no metrics endpoint
+        MessageLog::Options log; // Message log, off while log.dir is empty
+        MailboxStore::Limits mailbox;
+        int workers = 0; // Command workers, 0 = one per core, -1 = run commands on the reading thread
+        size_t worker_queue = WORKER_QUEUE_DEPTH; // Tasks queued per worker before readers block
+        int drain_timeout = DRAIN_TIMEOUT_S;
+        std::string handoff_path;  // Unix socket a new server can take the listening sockets over from
+        std::string takeover_path; // Take the listening sockets over from the server at this path
+        std::string rate_limits_path; // Per-user and per-group limits, none when empty
+    };
+
+
+
+// Queue an encoded frame for a specific client
+// Never blocks: whatever the socket doesn't take now waits in the client's outbound queue.
+// A control frame is queued even when the slow-consumer policy would drop it.
+
+    void send_payload(Connection& client, const Payload& payload, bool control = false) {
+        payload_stats.deliveries.add();
+#ifdef CHAT_IO_URING
+        // On the loop that owns the connection, output waits for the loop's next batch of sends
+        if (client.loop && client.loop == current_loop) {
+            if (client.out.push(payload, true, control)) {
+                uring_schedule(*client.loop, client.socket);
             }
+            return;
         }
+#endif
+        if (!client.out.push(payload, false, control)) return;
+
+        if (client.wake_fd >= 0) {
+            eventfd_write(client.wake_fd, 1); // Wake the owning thread to drain the rest
+        }
+#ifdef CHAT_IO_URING
+        else if (client.loop) {
+            uring_schedule(*client.loop, client.socket);
+        }
+#endif
     }
 
-// Send private message to a specific user
+// Send a text line to a specific client as one frame, a TEXT frame for binary clients
 
-    void private_message(const std::string& sender, const std::string& recipient, const std::string& message) {
-        std::lock_guard<std::mutex> lock(mtx);
-        if (user_sockets.find(recipient) != user_sockets.end()) {
-            send_message(user_sockets[recipient],  sender + ": " + message);
-        } 
-        else {
-            send_message(user_sockets[sender], "User not found!");
+    void send_message(Connection& client, std::initializer_list<std::string_view> parts) {
+        send_payload(client, client.binary ? make_binary_payload(BinaryOp::TEXT, 0, 0, parts) : make_payload(parts));
+    }
+
+    void send_message(Connection& client, std::string_view text) {
+        send_message(client, {text});
+    }
+
+// Tell a binary client the names behind IDs it hasn't been sent yet (0 = none). The lock keeps a
+// frame that uses an ID from overtaking the frame that names it, when two threads send at once.
+
+    void learn_names(Connection& client, uint32_t user, uint32_t group) {
+        std::lock_guard<std::mutex> lock(client.names_mtx);
+        auto learn = [&](std::vector<bool>& known, BinaryOp op, uint32_t id, const InternTable& table) {
+            if (id == 0 || (id < known.size() && known[id])) return;
+            if (id >= known.size()) known.resize(id + 1);
+            known[id] = true;
+            send_payload(client, make_binary_payload(op, id, 0, {table.name(id)}), true); // Never resent, so never dropped
+        };
+        learn(client.known_users, BinaryOp::USER_NAME, user, user_ids);
+        learn(client.known_groups, BinaryOp::GROUP_NAME, group, group_ids);
+    }
+
+// A message for several recipients: encoded once for text clients and, at the first binary
+// recipient, once for binary clients, who get IDs in place of the sender and group names
+
+    struct Fanout {
+        Payload text;
+        BinaryOp op = BinaryOp::TEXT;
+        uint32_t sender = 0;
+        uint32_t group = 0;
+        std::string_view body; // Body of the binary frame
+        Payload binary;
+    };
+
+    // Whether a message relayed as text (prefix parts around the body) and as a binary op fits
+    // in a frame. The text line must also fit wrapped in a binary TEXT frame, as mailboxes and
+    // /history replay it to binary clients that way.
+    static bool relay_fits(std::initializer_list<std::string_view> text, BinaryOp op, std::string_view body) {
+        return 1 + parts_size(text) <= MAX_FRAME_SIZE && 1 + 4 * binary_id_count(op) + body.size() <= MAX_FRAME_SIZE;
+    }
+
+    // A server notice, the same line for both protocols
+    Fanout notice(Payload text) {
+        std::string_view line = std::string_view(*text).substr(FRAME_HEADER_SIZE);
+        return Fanout{std::move(text), BinaryOp::TEXT, 0, 0, line, nullptr};
+    }
+
+    void send_fanout(Connection& client, Fanout& message) {
+        if (!client.binary) {
+            send_payload(client, message.text);
+            return;
+        }
+        if (!message.binary) {
+            message.binary = make_binary_payload(message.op, message.sender, message.group, {message.body});
+        }
+        learn_names(client, message.sender, message.group);
+        send_payload(client, message.binary);
+    }
+
+// Broadcast message to all clients, the frame is encoded once and shared by every recipient
+
+    void broadcast_message(Fanout message, const Connection* sender) {
+        ScopedTimer timer(server_metrics.broadcast_fanout);
+        connections.for_each([&](uint32_t, const std::shared_ptr<Connection>& client) {
+            if (client.get() != sender) {
+                send_fanout(*client, message);
+            }
+        });
+    }
+
+// Send private message to a specific user, or keep it in their mailbox while they are offline
+
+    enum class Delivery { SENT, STORED, MAILBOX_FULL, NO_USER };
+
+    Delivery private_message(const Connection& sender_conn, std::string_view recipient, uint32_t recipient_id, std::string_view message) {
+        std::string_view sender = sender_conn.username;
+        Fanout payload{make_payload({sender, ": ", message}), BinaryOp::MSG_FROM, sender_conn.user_id, 0, message, nullptr};
+        auto deliver = [&]() {
+            std::shared_ptr<Connection> client = online.load(recipient_id); // ID 0 (never logged in) is always empty
+            if (client) send_fanout(*client, payload);
+            return client != nullptr;
+        };
+
+        Delivery result = Delivery::SENT;
+        if (!deliver()) {
+            if (!mailboxes || !credentials->exists(std::string(recipient))) {
+                return Delivery::NO_USER;
+            }
+            switch (mailboxes->deposit(recipient, payload.text, deliver)) {
+            case MailboxStore::Result::DELIVERED: result = Delivery::SENT; break;
+            case MailboxStore::Result::STORED:    result = Delivery::STORED; break;
+            case MailboxStore::Result::FULL:      return Delivery::MAILBOX_FULL;
+            }
         }
+        log_message(LogKind::PRIVATE, sender, recipient, message);
+        return result;
     }
 
 // Send message to a group
 
-    void group_message(const std::string& sender, const std::string& group_name, const std::string& message) {
-                                                    
-        std::lock_guard<std::mutex> lock(mtx); // This ensures that access to shared resources (clients map) is thread-safe.
-        
-        // Lock the specific group mutex to ensure thread safety for this group
-        std::lock_guard<std::mutex> group_lock(group_mutexes[group_name]);
-    
-    
-        if (groups.find(group_name) == groups.end()) {
-            send_message(user_sockets[sender], "Group not found!");
+    void group_message(Connection& sender_conn, std::string_view sender, std::string_view group_name, uint32_t group_id, std::string_view message) {
+
+        // Snapshot of the members, joins and leaves during the fan-out don't block it
+        MemberList members = groups.members(group_id);
+
+        if (!members) {
+            send_message(sender_conn, {"Error: Group ", group_name, " does not exist."});
             return;
         }
-    
-        if (groups[group_name].find(sender) == groups[group_name].end()) {
-            send_message(user_sockets[sender], "You are not a member of the group " + group_name + "!");
+
+        if (!GroupTable::is_member(members, sender_conn.user_id)) {
+            send_message(sender_conn, {"Error: You are not a member of the group ", group_name});
+            return;
+        }
+
+        if (rate_limits && !rate_limits->groups.allow(group_id)) {
+            server_metrics.group_rate_limited.add();
+            send_message(sender_conn, {"Error: Group ", group_name, " is over its rate limit, message dropped."});
             return;
         }
-    
-        for (const auto& member : groups[group_name]) {
-                if (user_sockets.find(member) != user_sockets.end() && member != sender) {
-                    send_message(user_sockets[member], "[Group " + group_name + "] " + sender + ": " + message);
+
+        ScopedTimer timer(server_metrics.group_fanout);
+        Fanout payload{make_payload({"[Group ", group_name, "] ", sender, ": ", message}), BinaryOp::GROUP_MSG_FROM,
+                       sender_conn.user_id, group_id, message, nullptr};
+        for (uint32_t member : *members) {
+            if (member != sender_conn.user_id) {
+                auto deliver = [&]() {
+                    std::shared_ptr<Connection> client = online.load(member);
+                    if (client) send_fanout(*client, payload);
+                    return client != nullptr;
+                };
+                if (!deliver() && mailboxes) {
+                    mailboxes->deposit(user_ids.name(member), payload.text, deliver); // Offline member, dropped if the mailbox is full
                 }
+            }
         }
+        log_message(LogKind::GROUP, sender, group_name, message);
     }
 
-// Handle client commands
-    char buffer[BUFFER_SIZE];
-    void handle_client(int client_socket) {
-        std::string username;
-    
-    // Authentication
-        send_message(client_socket, "Enter username: ");
+// Replay the latest messages of a group to one of its members, read back from the message log
 
-        memset(buffer, 0, BUFFER_SIZE);
-        if( recv(client_socket, buffer, BUFFER_SIZE, 0)<=0){
-            close(client_socket);
+    void group_history(Connection& client, std::string_view group_name, uint32_t group_id, size_t count) {
+        MemberList members = groups.members(group_id);
+
+        if (!members) {
+            send_message(client, {"Error: Group ", group_name, " does not exist."});
             return;
         }
-        username = buffer;
-        send_message(client_socket, "Enter password: ");
-
-        memset(buffer, 0, BUFFER_SIZE);
-        if(recv(client_socket, buffer, BUFFER_SIZE, 0)<=0){
-            close(client_socket);
 
+        if (!GroupTable::is_member(members, client.user_id)) {
+            send_message(client, {"Error: You are not a member of the group ", group_name});
             return;
         }
-        
-    std::string password = buffer;
-    
-
-    // Check credentials from users.txt
-    std::ifstream user_file("users.txt");
-    std::string line, stored_user, stored_pass;
-    bool auth_success = false;
-    while (std::getline(user_file, line)) {
-        std::istringstream iss(line);
-
-        std::getline(iss, stored_user, ':');
-        std::getline(iss, stored_pass);
-        if (username == stored_user && password == stored_pass) {
-            auth_success = true;
-            break;
+
+        size_t served = message_log->history(group_name, count, [&](const LogRecord& record) {
+            send_message(client, {"[Group ", record.target, "] ", record.sender, ": ", record.text});
+        });
+        if (served == 0) {
+            send_message(client, {"No messages in group ", group_name, " yet."});
         }
     }
-    user_file.close();
 
-    if (!auth_success) {
-        send_message(client_socket, "Authentication failed. Disconnecting.");
-        close(client_socket);
-        return;
-    }
+// Commands run on a fixed pool of workers, nullptr when they run on the thread that read them
+
+    std::unique_ptr<WorkerPool> workers;
 
-    {   // Add user to active clients
-        std::lock_guard<std::mutex> lock(mtx);
 
-        clients[client_socket] = username;
-        user_sockets[username] = client_socket;
-    }
-    send_message(client_socket, "Welcome to the Chat server, " + username);
 
+// Per-connection protocol state. Both the thread-per-client loop and the reactor
+// feed received messages into the same state machine. The reading thread owns the
+// reader; with a worker pool, everything else is only touched by the connection's
+// worker, one task at a time.
 
-    // Notify others
-        std::string join_msg =  username + " has joined the chat!\n";
-        broadcast_message(join_msg, client_socket);
+    struct Session {
+        enum class State { AWAIT_USERNAME, AWAIT_PASSWORD, ACTIVE };
+
+        std::shared_ptr<Connection> conn;
+        State state = State::AWAIT_USERNAME;
+        std::string username;
+        FrameReader reader; // Pooled receive buffer, partial frames carry over between recv() calls
+        std::shared_ptr<WorkerPool::Mailbox> mailbox; // Commands waiting for the worker
+        std::atomic<bool> finished{false}; // A command ended the session, ignore anything after it
+    };
+
+    void session_start(Session& session) {
+        server_metrics.connections.add(1);
+        if (workers) {
+            session.mailbox = workers->open();
+        }
+        send_message(*session.conn, "Enter username: ");
+    }
 
+    // Remove the user from the active lists and close the socket
+    void session_close(Session& session) {
+        if (session.state == Session::State::ACTIVE) {
+            connections.store(session.conn->index, nullptr);
+            connection_slots.release(session.conn->index);
+            online.replace_if_equal(session.conn->user_id, session.conn, nullptr);
+        }
+        session.conn->out.close_socket(); // Senders still holding the Connection just see a closed queue
+        if (session.conn->wake_fd >= 0) {
+            close(session.conn->wake_fd);
+        }
+        server_metrics.connections.add(-1);
+    }
 
-    while (true) {
+// Hand a user who just logged in everything that arrived while they were offline, in one write
 
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
+    void deliver_mailbox(Connection& client, const std::string& username) {
+        std::string frames;
+        size_t count = mailboxes->take(username, frames);
+        if (count == 0) return;
 
-        if (bytes_received <= 0) {
-            std::lock_guard<std::mutex> lock(mtx);
-            clients.erase(client_socket);
-            user_sockets.erase(username);
-            close(client_socket);
-            return;
+        std::string header = "You have " + std::to_string(count) + " offline message(s):";
+        std::string batch;
+        if (!client.binary) {
+            batch = encode_frame(header);
+            batch += frames;
         }
-        
-        std::string message = buffer;        
-        std::istringstream iss(message);
-        std::string command;
-        iss >> command;
+        else {
+            // Mailboxes keep text frames, a binary client gets each of them as a TEXT frame
+            append_binary(batch, BinaryOp::TEXT, 0, 0, {header});
+            std::string_view rest = frames;
+            while (rest.size() >= FRAME_HEADER_SIZE) {
+                const unsigned char* p = reinterpret_cast<const unsigned char*>(rest.data());
+                size_t len = (size_t(p[0]) << 24) | (size_t(p[1]) << 16) | (size_t(p[2]) << 8) | size_t(p[3]);
+                append_binary(batch, BinaryOp::TEXT, 0, 0, {rest.substr(FRAME_HEADER_SIZE, len)});
+                rest.remove_prefix(std::min(rest.size(), FRAME_HEADER_SIZE + len));
+            }
+        }
+        send_payload(client, std::make_shared<const std::string>(std::move(batch)));
+    }
 
+// Admission control, checked before a message is routed anywhere. False (and the sender told) when
+// the sender is over their rate limit.
 
+    bool admit_message(Connection& client, CommandType type) {
+        if (!rate_limits || rate_limits->users.allow(client.user_id)) return true;
+        server_metrics.user_rate_limited[size_t(type)].add();
+        send_message(client, "Error: Rate limit exceeded, message dropped.");
+        return false;
+    }
 
-        if (command != "/broadcast" && command != "/msg" && command != "/create_group" &&
-            command != "/join_group" && command != "/leave_group" && command != "/group_msg" && command != "/exit" ) {
+// Handle one command from an authenticated client, returns false when the client should be disconnected
+// The command was parsed in place, its arguments are views into the receive buffer
+
+    bool handle_command(Session& session, const Command& cmd) {
+        Connection& client = *session.conn;
+        const std::string& username = session.username;
+
+        server_metrics.commands[size_t(cmd.type)].add();
+
+        switch (cmd.type) {
+
+        case CommandType::INVALID:
+            send_message(client, "Error, Invalid command!");
+            break;
 
-            send_message(client_socket, "Error, Invalid command!");
-            continue;
-        }
 
 
-        
-        if (command == "/broadcast") {
-            std::string msg;
-            std::getline(iss, msg);
-            msg.erase(0, msg.find_first_not_of(" \t\r\n")); // Trim left spaces
+        case CommandType::BROADCAST:
+            if(cmd.body.empty()){
+                send_message(client,"Usage: /broadcast <message>");
 
-            if(msg.empty()){
-                send_message(client_socket,"Usage: /broadcast <message>");
+            }
 
+            else if (!relay_fits({"broadcast from ", username, ": ", cmd.body}, BinaryOp::BROADCAST_FROM, cmd.body)) {
+                send_message(client, "Error: Message too long, message dropped.");
             }
 
-            else{
-            broadcast_message("broadcast from " +username + ": " + msg, client_socket);
+            else if (admit_message(client, cmd.type)) {
+            broadcast_message({make_payload({"broadcast from ", username, ": ", cmd.body}), BinaryOp::BROADCAST_FROM, client.user_id, 0, cmd.body, nullptr}, &client);
+            log_message(LogKind::BROADCAST, username, "", cmd.body);
             }
-        } 
+            break;
 
 
-        
-        else if (command == "/msg") {
-            std::string recipient;
-            iss >> recipient;
-            std::string msg;
-            std::getline(iss, msg);
-            msg.erase(0, msg.find_first_not_of(" \t\r\n")); // Trim left spaces
-            
-            if (recipient.empty() || msg.empty()) {
-                send_message(client_socket, "Usage: /msg <username> <message>");
+
+        case CommandType::MSG:
+            if (cmd.arg.empty() || cmd.body.empty()) {
+                send_message(client, "Usage: /msg <username> <message>");
             }
 
-            else if (user_sockets.find(recipient) == user_sockets.end()) {
-                send_message(client_socket, "User not found!");
-            } 
+            else if (!relay_fits({username, ": ", cmd.body}, BinaryOp::MSG_FROM, cmd.body)) {
+                send_message(client, "Error: Message too long, message dropped.");
+            }
 
-            else {
-                send_message(user_sockets[recipient],username + ": " + msg);
+            else if (admit_message(client, cmd.type)) {
+                uint32_t recipient = cmd.id ? cmd.id : user_ids.find(cmd.arg);
+                Delivery delivery = private_message(client, cmd.arg, recipient, cmd.body);
+                if (client.binary && delivery != Delivery::NO_USER) {
+                    learn_names(client, recipient, 0); // So the next one can go by ID
+                }
+
+                if (delivery == Delivery::NO_USER) {
+                    send_message(client, "User not found!");
+                }
+                else if (delivery == Delivery::STORED) {
+                    send_message(client, {"User ", cmd.arg, " is offline, the message will be delivered when they log in."});
+                }
+                else if (delivery == Delivery::MAILBOX_FULL) {
+                    send_message(client, {"User ", cmd.arg, " is offline and their mailbox is full, message dropped."});
+                }
             }
-        }
- 
+            break;
 
 
-        else if (command == "/create_group") {  
-            std::string group_name;
 
-            if (!(iss >> group_name)){
-                send_message(client_socket, "Usage: /create_group <group_name>");
+        case CommandType::CREATE_GROUP:
+            if (cmd.arg.empty()){
+                send_message(client, "Usage: /create_group <group_name>");
 
             }
-            else { 
-                // Read the group name after the command
-
-                std::lock_guard<std::mutex> lock(mtx);
-                if(groups.find(group_name)!=groups.end()){
-                     send_message(client_socket, "Group already exists!");
+            else {
+                uint32_t group_id = group_ids.intern(cmd.arg);
+                if (group_id == 0) {
+                    send_message(client, "Error: The server cannot hold any more groups.");
+                }
+                else if(!groups.create(group_id, client.user_id)){
+                     send_message(client, "Group already exists!");
                 }
                 else{
-                    groups[group_name].insert(username);
-                    send_message(client_socket, "Group " + group_name + " created ."); // Extra space before the period
+                    if (rate_limits) rate_limits->groups.assign(group_id, cmd.arg);
+                    if (client.binary) learn_names(client, 0, group_id);
+                    send_message(client, {"Group ", cmd.arg, " created ."}); // Extra space before the period
                 }
             }
-        }
-        
+            break;
 
 
-        else if (command == "/join_group") {  
-            std::string group_name;
 
-            if (iss >> group_name) { 
-            std::lock_guard<std::mutex> lock(mtx);
+        case CommandType::JOIN_GROUP:
+            if (!cmd.arg.empty()) {
+                uint32_t group_id = group_ids.find(cmd.arg);
+                MembershipResult result = group_id ? groups.join(group_id, client.user_id) : MembershipResult::NO_GROUP;
 
                 // Check if the group exists
-                if (groups.find(group_name) == groups.end()) {
+                if (result == MembershipResult::NO_GROUP) {
 
-                    send_message(client_socket, "Error: Group " + group_name + " does not exist.");
-                    return;
+                    send_message(client, {"Error: Group ", cmd.arg, " does not exist."});
                 }
                     // Check if user is already part of the group
-                else if (groups[group_name].find(username) != groups[group_name].end()) {
+                else if (result == MembershipResult::ALREADY_MEMBER) {
 
-                    send_message(client_socket, " You are already a member of the group " + group_name + "!");
+                    send_message(client, {" You are already a member of the group ", cmd.arg, "!"});
                 }
                 else {
-                    groups[group_name].insert(username);                        send_message(client_socket, "You joined the group " + group_name + " .");
+                    if (client.binary) learn_names(client, 0, group_id);
+                    send_message(client, {"You joined the group ", cmd.arg, " ."});
                 }
             }
 
             else {
-                send_message(client_socket, "Usage: /join_group <group_name>");
+                send_message(client, "Usage: /join_group <group_name>");
             }
-        }
+            break;
+
+
 
-    
 
-        
-        else if (command == "/leave_group") {  
-            std::string group_name;
-            
-            if (iss >> group_name) { 
-                // Read the group name after the command
-                std::lock_guard<std::mutex> lock(mtx);
-        
+        case CommandType::LEAVE_GROUP:
+            if (!cmd.arg.empty()) {
+                uint32_t group_id = group_ids.find(cmd.arg);
+                MembershipResult result = group_id ? groups.leave(group_id, client.user_id) : MembershipResult::NO_GROUP;
+
                 // Check if the group exists
-                if (groups.find(group_name) == groups.end()) {
-                    send_message(client_socket, "Error: Group " + group_name + " does not exist.");
-                    return;
+                if (result == MembershipResult::NO_GROUP) {
+                    send_message(client, {"Error: Group ", cmd.arg, " does not exist."});
                 }
 
                 // Check if the user is part of the group
-                else if (groups[group_name].find(username) == groups[group_name].end()) {
-                    send_message(client_socket, "Error: You are not a member of the group " + group_name);
-                    return;
+                else if (result == MembershipResult::NOT_MEMBER) {
+                    send_message(client, {"Error: You are not a member of the group ", cmd.arg});
                 }
 
-                // Remove user from the group
-                groups[group_name].erase(username);
-                send_message(client_socket, "You left the group " + group_name + ".");
+                // User was removed from the group
+                else {
+                    send_message(client, {"You left the group ", cmd.arg, "."});
+                }
+            }
+
+            else {
+                send_message(client, "Usage: /leave_group <group_name>");
+            }
+            break;
+
+
+        case CommandType::GROUP_MSG:
+            if (cmd.arg.empty() || cmd.body.empty()) {
+                send_message(client, "Usage: /group_msg <group_name> <message>");
+            }
+            else if (!relay_fits({"[Group ", cmd.arg, "] ", username, ": ", cmd.body}, BinaryOp::GROUP_MSG_FROM, cmd.body)) {
+                send_message(client, "Error: Message too long, message dropped.");
+            }
+            else if (admit_message(client, cmd.type)) {
+                // Group existence and membership are checked against the fan-out snapshot
+                group_message(client, username, cmd.arg, cmd.id ? cmd.id : group_ids.find(cmd.arg), cmd.body);
             }
+            break;
+
+        case CommandType::HISTORY: {
+            size_t count = 0;
+            auto [end, error] = std::from_chars(cmd.body.data(), cmd.body.data() + cmd.body.size(), count);
 
+            if (cmd.arg.empty() || error != std::errc() || end != cmd.body.data() + cmd.body.size() || count == 0) {
+                send_message(client, "Usage: /history <group_name> <n>");
+            }
+            else if (!message_log) {
+                send_message(client, "Error: Message history is not enabled on this server.");
+            }
             else {
-                send_message(client_socket, "Usage: /leave_group <group_name>");
+                group_history(client, cmd.arg, group_ids.find(cmd.arg), std::min<size_t>(count, LOG_HISTORY_KEEP));
             }
+            break;
         }
 
-        
-        else if (command == "/group_msg") {
-            std::string group_name;
-            iss >> group_name;
-            std::string msg;
-            std::getline(iss, msg);
-            msg.erase(0, msg.find_first_not_of(" \t\r\n")); // Trim left spaces
+        case CommandType::EXIT:
+            broadcast_message(notice(make_payload({username, " has left the chat server "})), &client);
+            return false;
+        }
 
-            {
-            std::lock_guard<std::mutex> lock(mtx);
-                if (group_name.empty() || msg.empty()) {
-                    send_message(client_socket, "Usage: /group_msg <group_name> <message>");
-                }
-        
-             // Check if the group exists
-                else if (groups.find(group_name) == groups.end()) {
-                    send_message(client_socket, "Error: Group " + group_name + " does not exist.");
-                    continue;
-                }
+        return true;
+    }
 
-             // Check if the user is a member of the group
-                else if (groups[group_name].find(username) == groups[group_name].end()) {
-                    send_message(client_socket, "Error: You are not a member of the group " + group_name);
-                    continue;
-                }
-        
+// A command from a binary client, turned into the same Command the text parser produces.
+// IDs are resolved back to names; TEXT frames carry text commands.
+
+    bool handle_binary(Session& session, std::string_view message) {
+        BinaryFrame frame;
+        Command cmd;
+        if (!parse_binary(message, frame)) {
+            return handle_command(session, cmd); // Invalid
+        }
+
+        switch (frame.op) {
+        case BinaryOp::TEXT:
+            return handle_command(session, parse_command(frame.body));
+        case BinaryOp::BROADCAST:
+            cmd.type = CommandType::BROADCAST;
+            break;
+        case BinaryOp::MSG:
+            cmd.type = CommandType::MSG;
+            cmd.id = frame.ids[0];
+            cmd.arg = user_ids.name(cmd.id);
+            if (cmd.arg.empty()) {
+                server_metrics.commands[size_t(cmd.type)].add();
+                send_message(*session.conn, "User not found!");
+                return true;
             }
+            break;
+        case BinaryOp::GROUP_MSG:
+            cmd.type = CommandType::GROUP_MSG;
+            cmd.id = frame.ids[0];
+            cmd.arg = group_ids.name(cmd.id);
+            if (cmd.arg.empty()) {
+                server_metrics.commands[size_t(cmd.type)].add();
+                send_message(*session.conn, "Error: Group does not exist.");
+                return true;
+            }
+            break;
+        default:
+            break; // Server-to-client opcodes
+        }
+        cmd.body = frame.body;
+        return handle_command(session, cmd);
+    }
+
+// Feed one received message into the session, returns false when the session is finished
 
-            group_message(username, group_name, msg);
+    bool session_on_message(Session& session, std::string_view message) {
+        if (session.conn->binary && session.state != Session::State::ACTIVE) {
+            // Login replies from a binary client come as TEXT frames
+            BinaryFrame frame;
+            message = parse_binary(message, frame) && frame.op == BinaryOp::TEXT ? frame.body : std::string_view();
         }
 
-        else if (command == "/exit") {
-            std::string leave_message = username + " has left the chat server ";
-            broadcast_message(leave_message, client_socket);
-            close(client_socket);
+        switch (session.state) {
+
+        case Session::State::AWAIT_USERNAME:
+            if (message == BINARY_HELLO) {
+                // Accepted by answering in binary from the next prompt on
+                session.conn->binary = true;
+                session.conn->out.set_binary();
+                return true;
+            }
+            session.username.assign(message);
+            session.state = Session::State::AWAIT_PASSWORD;
+            send_message(*session.conn, "Enter password: ");
+            return true;
+
+        case Session::State::AWAIT_PASSWORD:
+            if (!credentials->authenticate(session.username, message)) {
+                server_metrics.auth_failures.add();
+                send_message(*session.conn, "Authentication failed. Disconnecting.");
+                return false;
+            }
+
+            // Add user to active clients
+            session.conn->username = session.username;
+            session.conn->user_id = user_ids.intern(session.username);
+            session.conn->index = connection_slots.acquire();
+            if (session.conn->user_id == 0 || !connections.store(session.conn->index, session.conn)) {
+                connection_slots.release(session.conn->index);
+                send_message(*session.conn, "Server is full. Disconnecting.");
+                return false;
+            }
+            if (rate_limits) rate_limits->users.assign(session.conn->user_id, session.username);
+            online.store(session.conn->user_id, session.conn);
+            session.state = Session::State::ACTIVE;
+            server_metrics.logins.add();
+            if (session.conn->binary) server_metrics.binary_logins.add();
+            send_message(*session.conn, "Welcome to the Chat server, " + session.username);
+            if (mailboxes) {
+                deliver_mailbox(*session.conn, session.username);
+            }
+
+            // Notify others
+            broadcast_message(notice(make_payload({session.username, " has joined the chat!\n"})), session.conn.get());
+            return true;
+
+        case Session::State::ACTIVE:
+            return session.conn->binary ? handle_binary(session, message) : handle_command(session, parse_command(message));
+        }
+        return false;
+    }
+
+// Read from the socket straight into the session's receive buffer.
+// Returns what recv() returned, 0 once the peer is gone.
+
+    ssize_t session_recv(Session& session) {
+        size_t room;
+        char* area = session.reader.write_area(room);
+        return recv(session.conn->socket, area, room, 0);
+    }
+
+// Dispatch every complete frame in the session's receive buffer, returns false once the session is over.
+// With a pool each frame is copied into a task for the session's worker; a command that
+// ends the session shuts the socket for reading, so the reading thread sees EOF and stops.
+// A reader that must not block on a full pool passes stalled: dispatching then stops early,
+// leaving the remaining frames buffered, and *stalled is set.
+
+    bool session_dispatch(const std::shared_ptr<Session>& session, bool* stalled = nullptr) {
+        std::string_view frame;
+        while (true) {
+            if (stalled && workers && workers->full(*session->mailbox)) {
+                *stalled = true;
+                return true;
+            }
+            if (!session->reader.next(frame)) break;
+
+            if (!workers) {
+                if (!session_on_message(*session, frame)) return false;
+                continue;
+            }
+
+            if (session->finished) return false;
+            workers->submit(session->mailbox, [session, message = std::string(frame)]() {
+                if (session->finished) return;
+                if (!session_on_message(*session, message)) {
+                    session->finished = true;
+                    shutdown(session->conn->socket, SHUT_RD);
+                }
+            });
+        }
+        session->reader.trim(); // Don't sit on a large buffer while the connection is idle
+        return !session->reader.bad(); // Oversized frame, the stream can't be resynchronised
+    }
+
+// Account for len bytes received by session_recv()
+
+    bool session_on_data(const std::shared_ptr<Session>& session, size_t len) {
+        server_metrics.bytes_in.add(len);
+        session->reader.commit(len);
+        return session_dispatch(session);
+    }
+
+// Same for bytes received into a buffer the session doesn't own (io_uring's provided buffers)
+
+    bool session_on_bytes(const std::shared_ptr<Session>& session, const char* data, size_t len, bool* stalled = nullptr) {
+        server_metrics.bytes_in.add(len);
+        session->reader.append(data, len);
+        return session_dispatch(session, stalled);
+    }
+
+// The reading thread is done with the session. Queued commands still run before it closes.
+
+    void session_end(const std::shared_ptr<Session>& session) {
+        if (!workers) {
+            session_close(*session);
             return;
         }
+        workers->submit(session->mailbox, [session]() { session_close(*session); });
     }
 
-     close(client_socket);  // Proper cleanup
-  
-}
 
 
-int main() {
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+// Thread-per-client mode: one reader per connection, which also drains its outbound
+// queue whenever the socket is writable or another thread left output pending
+
+    void handle_client(int client_socket) {
+        auto session = std::make_shared<Session>();
+        Connection& conn = *(session->conn = std::make_shared<Connection>(client_socket));
+        conn.wake_fd = eventfd(0, EFD_CLOEXEC);
+        session_start(*session);
+
+        bool open = conn.wake_fd >= 0;
+        while (open) {
+            pollfd fds[2] = {
+                {client_socket, short(POLLIN | (conn.out.pending() ? POLLOUT : 0)), 0},
+                {conn.wake_fd, POLLIN, 0},
+            };
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+
+            if (fds[1].revents & POLLIN) {
+                eventfd_t ignored;
+                eventfd_read(conn.wake_fd, &ignored);
+            }
+            if (fds[0].revents & POLLOUT || fds[1].revents & POLLIN) {
+                conn.out.flush();
+            }
+            if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t bytes_received = session_recv(*session);
+                if (bytes_received <= 0) {
+                    break;
+                }
+                open = session_on_data(session, bytes_received);
+            }
+        }
+
+        session_end(session);  // Proper cleanup
+    }
+
+    // A listening socket on PORT. With SO_REUSEPORT every acceptor binds its own socket with its
+    // own accept queue, and the kernel hashes incoming connections over them. Non-blocking in
+    // every mode: after a handoff two processes accept on it, and either may win a connection.
+    int open_listener(int backlog) {
+        int server_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (server_socket < 0) {
+            perror("socket");
+            exit(EXIT_FAILURE);
+        }
 
-    sockaddr_in server_address{};
-    server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(PORT);
-    server_address.sin_addr.s_addr = INADDR_ANY;
+        sockaddr_in server_address{};
+        server_address.sin_family = AF_INET;
+        server_address.sin_port = htons(PORT);
+        server_address.sin_addr.s_addr = INADDR_ANY;
 
-    int opt=1;
+        int opt=1;
 
-    // Set socket options 
-        if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
+        // Set socket options
+        if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+            setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
             perror("setsockopt");
             exit(EXIT_FAILURE);
         }
@@ -360,69 +910,1097 @@ int main() {
             exit(EXIT_FAILURE);
         }
 
-        if (listen(server_socket, 10) < 0) {
+        if (listen(server_socket, backlog) < 0) {
             perror("Listen failed");
             exit(EXIT_FAILURE);
         }
+        return server_socket;
+    }
 
-    std::cout << "Server is listening on port " << PORT << std::endl;
+    // Returns once the server is stopping
+    void accept_loop(int server_socket) {
+        pollfd fds[2] = {{server_socket, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+        while (poll(fds, 2, -1) >= 0 || errno == EINTR) {
+            if (stopping) break;
+            if (!(fds[0].revents & POLLIN)) continue;
+
+            // Drain the accept queue (the listener is non-blocking), a login storm fills it many connections at a time
+            while (!stopping) {
+                int client_socket = accept4(server_socket, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client_socket < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) perror("Client connection failed");
+                    break;
+                }
 
-    
+                std::thread(handle_client, client_socket).detach();
+            }
+        }
+    }
 
-    while (true) {
-        int client_socket = accept(server_socket, nullptr, nullptr);
-            if (client_socket < 0) {
-                perror("Client connection failed");
-                continue;
+    // One accepting thread per listening socket
+    void run_threads(const std::vector<int>& listeners) {
+        std::cout << "Thread mode with " << listeners.size() << " listener(s)" << std::endl;
+
+        std::vector<std::thread> acceptors;
+        for (size_t i = 1; i < listeners.size(); ++i) {
+            acceptors.emplace_back(accept_loop, listeners[i]);
+        }
+        accept_loop(listeners[0]);
+
+        for (auto& acceptor : acceptors) {
+            acceptor.join();
+        }
+    }
+
+
+
+// Reactor mode: edge-triggered epoll loops, each owning the sessions it accepted
+
+    bool set_nonblocking(int fd) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+
+    void reactor_loop(int server_socket) {
+        int epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd < 0) {
+            perror("epoll_create1");
+            return;
+        }
+
+        // The listening socket is this loop's own, the kernel spreads connections over the loops
+        epoll_event listen_event{};
+        listen_event.events = EPOLLIN;
+        listen_event.data.fd = server_socket;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, server_socket, &listen_event) < 0) {
+            perror("epoll_ctl");
+            close(epfd);
+            return;
+        }
+
+        // Becomes readable when the server is stopping: the loop stops accepting and checks for the end of the drain
+        epoll_event stop_event{};
+        stop_event.events = EPOLLIN;
+        stop_event.data.fd = stop_fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, stop_fd, &stop_event);
+        bool accepting = true;
+
+        std::unordered_map<int, std::shared_ptr<Session>> sessions;
+        epoll_event events[MAX_EVENTS];
+
+        while (!stopped) {
+            int ready = epoll_wait(epfd, events, MAX_EVENTS, accepting ? -1 : STOP_POLL_MS);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                perror("epoll_wait");
+                break;
+            }
+
+            for (int e = 0; e < ready; ++e) {
+                int fd = events[e].data.fd;
+
+                if (stopping && (fd == server_socket || fd == stop_fd)) {
+                    if (accepting) {
+                        epoll_ctl(epfd, EPOLL_CTL_DEL, server_socket, nullptr);
+                        epoll_ctl(epfd, EPOLL_CTL_DEL, stop_fd, nullptr);
+                        accepting = false;
+                    }
+                    continue;
+                }
+
+                if (fd == server_socket) {
+                    // Drain the accept queue, a login storm fills it many connections at a time
+                    while (true) {
+                        int client_socket = accept4(server_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                        if (client_socket < 0) {
+                            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                                perror("Client connection failed");
+                            }
+                            break;
+                        }
+
+                        // EPOLLOUT edges tell us when a full socket drained and its queue can be flushed
+                        epoll_event client_event{};
+                        client_event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                        client_event.data.fd = client_socket;
+                        if (epoll_ctl(epfd, EPOLL_CTL_ADD, client_socket, &client_event) < 0) {
+                            perror("epoll_ctl");
+                            close(client_socket);
+                            continue;
+                        }
+
+                        auto session = std::make_shared<Session>();
+                        session->conn = std::make_shared<Connection>(client_socket);
+                        session_start(*session);
+                        sessions.emplace(client_socket, std::move(session));
+                    }
+                    continue;
+                }
+
+                auto it = sessions.find(fd);
+                if (it == sessions.end()) continue;
+                const std::shared_ptr<Session>& session = it->second;
+
+                if (events[e].events & EPOLLOUT) {
+                    session->conn->out.flush();
+                }
+                if (!(events[e].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) continue;
+
+                // Edge-triggered: read until the socket would block
+                bool open = true;
+                while (open) {
+                    ssize_t bytes_received = session_recv(*session);
+                    if (bytes_received > 0) {
+                        open = session_on_data(session, bytes_received);
+                    }
+                    else if (bytes_received < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    else if (bytes_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        break;
+                    }
+                    else {
+                        open = false;
+                    }
+                }
+
+                if (!open) {
+                    // The socket may stay open until the worker closes it, stop watching it now
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+                    session_end(session);
+                    sessions.erase(it);
+                }
             }
+        }
 
-        std::thread(handle_client, client_socket).detach();
+        // Stopped: whoever is still connected after the drain is cut off
+        for (auto& [fd, session] : sessions) {
+            session_end(session);
+        }
+        close(epfd);
     }
 
-    close(server_socket);  // Proper cleanup
+    // One event loop per listening socket
+    void run_reactor(const std::vector<int>& listeners) {
+        for (int server_socket : listeners) {
+            if (!set_nonblocking(server_socket)) {
+                perror("fcntl");
+                exit(EXIT_FAILURE);
+            }
+        }
+        std::cout << "Reactor mode with " << listeners.size() << " event loop(s)" << std::endl;
 
-    return 0;
-}
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < listeners.size(); ++i) {
+            workers.emplace_back(reactor_loop, listeners[i]);
+        }
+        reactor_loop(listeners[0]);
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+
+
+#ifdef CHAT_IO_URING
+// io_uring mode: a loop per core like the reactor, but with no readiness events. Each loop
+// keeps one multishot accept and one multishot receive per connection posted; the kernel
+// fills buffers from the loop's provided-buffer ring and posts a completion per read. Output
+// produced on the loop (commands run with --workers off) is sent by it for all connections
+// at once per round, so a group message to a thousand members costs one io_uring_enter()
+// instead of a thousand send()s. Other threads write directly as in the other modes and
+// leave what the socket doesn't take to the loop. The loop never blocks on a full worker
+// queue, since its pending sends would wait too: the session stalls instead (its receive is
+// cancelled, so TCP pushes back) and is retried shortly.
+
+    enum UringOp : uint64_t { URING_ACCEPT, URING_WAKE, URING_RECV, URING_SEND, URING_CANCEL, URING_TIMER, URING_STOP };
+
+    uint64_t uring_tag(UringOp op, int fd) {
+        return (uint64_t(fd) << 8) | op;
+    }
+
+    struct UringSession {
+        std::shared_ptr<Session> session;
+        bool receiving = false; // Multishot receive posted
+        bool sending = false;   // Send in flight, its frames are held by the outbound queue
+        bool ending = false;    // Close once the receive has stopped and the last output is out
+        bool flushed = false;   // Final non-blocking flush done
+        bool stalled = false;   // Worker queue full: receive cancelled, input parked in backlog
+        bool peer_done = false; // The receive ended while stalled, end the session after the backlog
+        std::string backlog;
+        msghdr msg{};
+        std::vector<iovec> iov; // Sized on first send
+    };
+
+    bool uring_accept(IoRing& ring, int server_socket) {
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = server_socket;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = uring_tag(URING_ACCEPT, server_socket);
+        return true;
+    }
+
+    bool uring_recv(IoRing& ring, int fd, UringSession& us) {
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = ring.buffer_group();
+        sqe->user_data = uring_tag(URING_RECV, fd);
+        us.receiving = true;
+        return true;
+    }
+
+    // Send whatever the connection has queued, unless a send is already in flight
+    void uring_send(IoRing& ring, int fd, UringSession& us) {
+        if (us.sending) return;
+        // A loop sends once per round, so each send takes far more frames than a sendmsg() from flush()
+        us.iov.resize(IOV_MAX);
+        int count = us.session->conn->out.prepare(us.iov.data(), IOV_MAX);
+        if (count == 0) return;
+
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (!sqe) {
+            us.session->conn->out.complete(-EAGAIN); // Put the frames back, retried on the next push
+            return;
+        }
+        us.msg.msg_iov = us.iov.data();
+        us.msg.msg_iovlen = count;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&us.msg);
+        sqe->len = 1;
+        // A closing connection gets one last try, it must not wait for a peer that stopped reading
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (us.ending ? MSG_DONTWAIT : 0);
+        sqe->user_data = uring_tag(URING_SEND, fd);
+        us.sending = true;
+    }
+
+    void uring_cancel(IoRing& ring, int fd, UringOp op) {
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (!sqe) return;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = uring_tag(op, fd);
+        sqe->user_data = uring_tag(URING_CANCEL, fd);
+    }
+
+    void uring_loop(int server_socket, UringLoop* loop) {
+        IoRing ring(uring_stats);
+        if (!ring.init(URING_ENTRIES, URING_BUFFERS, URING_BUFFER_SIZE, 0)) {
+            perror("io_uring");
+            return;
+        }
+        current_loop = loop;
+
+        std::unordered_map<int, UringSession> sessions; // Nodes don't move, so msg/iov stay put while in flight
+        std::vector<int> to_send;
+        std::vector<int> stalled;
+        std::vector<io_uring_cqe> received;
+        bool timer_armed = false;
+        __kernel_timespec retry{0, URING_STALL_RETRY_NS};
+        __kernel_timespec stop_poll{0, STOP_POLL_MS * 1000000};
+        uint64_t wake_value;
+
+        auto wait_for_wake = [&]() {
+            io_uring_sqe* sqe = ring.get_sqe();
+            if (!sqe) return;
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = loop->wake_fd;
+            sqe->addr = reinterpret_cast<uint64_t>(&wake_value);
+            sqe->len = sizeof(wake_value);
+            sqe->user_data = uring_tag(URING_WAKE, loop->wake_fd);
+        };
+
+        // The session is over: close it once the receive has stopped and its output is out
+        auto try_end = [&](std::unordered_map<int, UringSession>::iterator it) {
+            UringSession& us = it->second;
+            if (!us.ending || us.receiving || us.sending) return;
+            if (!us.flushed) {
+                us.flushed = true;
+                uring_send(ring, it->first, us); // e.g. "Authentication failed."
+                if (us.sending) return;
+            }
+            session_end(us.session);
+            sessions.erase(it);
+        };
+
+        // Hand received bytes to the session, parking them while its worker is full
+        auto feed = [&](int fd, UringSession& us, const char* data, size_t len) {
+            if (us.stalled) {
+                us.backlog.append(data, len);
+                return;
+            }
+            if (!session_on_bytes(us.session, data, len, &us.stalled)) {
+                us.ending = true;
+                shutdown(fd, SHUT_RD); // Ends the multishot receive
+            }
+            else if (us.stalled) {
+                stalled.push_back(fd);
+                uring_cancel(ring, fd, URING_RECV);
+            }
+        };
+
+        // Retry a stalled session, returns true while it is still stalled
+        auto resume = [&](std::unordered_map<int, UringSession>::iterator it) {
+            UringSession& us = it->second;
+            us.stalled = false;
+            bool open = session_dispatch(us.session, &us.stalled);
+            size_t fed = 0;
+            while (open && !us.stalled && fed < us.backlog.size()) {
+                size_t n = std::min<size_t>(us.backlog.size() - fed, URING_BUFFER_SIZE);
+                open = session_on_bytes(us.session, us.backlog.data() + fed, n, &us.stalled);
+                fed += n;
+            }
+            us.backlog.erase(0, fed);
+            if (open && us.stalled) return true;
+
+            us.stalled = false;
+            us.backlog.clear();
+            if (open && !us.peer_done) {
+                if (us.receiving || uring_recv(ring, it->first, us)) return false;
+            }
+            us.ending = true;
+            if (us.receiving) shutdown(it->first, SHUT_RD);
+            try_end(it);
+            return false;
+        };
+
+        // One completion of a connection's multishot receive
+        auto on_receive = [&](const io_uring_cqe& cqe) {
+            int fd = int(cqe.user_data >> 8);
+            auto it = sessions.find(fd);
+            if (it == sessions.end()) return;
+            UringSession& us = it->second;
+
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                uint16_t id = IoRing::buffer_id(cqe);
+                if (cqe.res > 0 && !us.ending) {
+                    feed(fd, us, ring.buffer(id), cqe.res);
+                }
+                ring.recycle(id);
+            }
+            if (cqe.flags & IORING_CQE_F_MORE) return;
+
+            // The receive stopped: out of buffers, cancelled by a stall, or the request ended for another reason
+            us.receiving = false;
+            if (us.stalled) {
+                if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ECANCELED && cqe.res != -ENOBUFS)) {
+                    us.peer_done = true;
+                }
+                return; // resume() posts a new receive
+            }
+            if (!us.ending && (cqe.res > 0 || cqe.res == -ENOBUFS || cqe.res == -ECANCELED)) { // Cancelled by a stall that has cleared
+                if (cqe.res == -ENOBUFS) ring.note_nobufs();
+                if (uring_recv(ring, fd, us)) return;
+            }
+
+            // EOF or error: a send stuck on a peer that no longer reads is not waited for
+            us.ending = true;
+            if (us.sending) uring_cancel(ring, fd, URING_SEND);
+            try_end(it);
+            return;
+        };
+
+        if (!uring_accept(ring, server_socket)) return;
+        wait_for_wake();
+
+        // Completes when the server is stopping: the accept is cancelled and a timer keeps checking for the end of the drain
+        if (io_uring_sqe* sqe = ring.get_sqe()) {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = stop_fd;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = uring_tag(URING_STOP, stop_fd);
+        }
+
+        while (!stopped) {
+            for (size_t i = 0; i < stalled.size();) {
+                auto it = sessions.find(stalled[i]);
+                if (it != sessions.end() && it->second.stalled && resume(it)) {
+                    ++i;
+                    continue;
+                }
+                stalled[i] = stalled.back();
+                stalled.pop_back();
+            }
+            if ((!stalled.empty() || stopping) && !timer_armed) {
+                if (io_uring_sqe* sqe = ring.get_sqe()) {
+                    sqe->opcode = IORING_OP_TIMEOUT;
+                    sqe->addr = reinterpret_cast<uint64_t>(stalled.empty() ? &stop_poll : &retry);
+                    sqe->len = 1;
+                    sqe->user_data = uring_tag(URING_TIMER, 0);
+                    timer_armed = true;
+                }
+            }
+
+            // Everything queued since the last round goes out in this round's single submission
+            loop->woken = false;
+            {
+                std::lock_guard<std::mutex> lock(loop->mtx);
+                to_send.swap(loop->to_send);
+            }
+            for (int fd : to_send) {
+                auto it = sessions.find(fd);
+                if (it != sessions.end() && !it->second.ending) {
+                    uring_send(ring, fd, it->second);
+                }
+            }
+            to_send.clear();
+
+            // Don't sleep while completions left over from the last round are waiting
+            int submitted = ring.submit(ring.ready() ? 0 : 1);
+            if (submitted < 0 && submitted != -EBUSY) {
+                errno = -submitted;
+                perror("io_uring_enter");
+                break;
+            }
+
+            // Bounded like the reactor's epoll_wait(), so replies go out between batches of reads
+            ring.for_each_completion([&](const io_uring_cqe& cqe) {
+                int fd = int(cqe.user_data >> 8);
+
+                switch (UringOp(cqe.user_data & 0xff)) {
+                case URING_ACCEPT: {
+                    if (!(cqe.flags & IORING_CQE_F_MORE) && !stopping) {
+                        uring_accept(ring, server_socket);
+                    }
+                    if (cqe.res < 0) {
+                        if (!stopping) {
+                            errno = -cqe.res;
+                            perror("Client connection failed");
+                        }
+                        return;
+                    }
+
+                    auto session = std::make_shared<Session>();
+                    session->conn = std::make_shared<Connection>(cqe.res);
+                    session->conn->loop = loop;
+                    UringSession& us = sessions[cqe.res];
+                    us.session = std::move(session);
+                    session_start(*us.session);
+                    if (!uring_recv(ring, cqe.res, us)) {
+                        us.ending = true;
+                        try_end(sessions.find(cqe.res));
+                    }
+                    return;
+                }
+
+                case URING_WAKE:
+                    wait_for_wake();
+                    return;
+
+                case URING_RECV:
+                    received.push_back(cqe);
+                    return;
+
+                case URING_SEND: {
+                    auto it = sessions.find(fd);
+                    if (it == sessions.end()) return;
+                    UringSession& us = it->second;
+                    us.sending = false;
+                    if (us.session->conn->out.complete(cqe.res) && !us.ending) {
+                        uring_send(ring, fd, us);
+                    }
+                    try_end(it);
+                    return;
+                }
+
+                case URING_CANCEL:
+                    return;
+
+                case URING_TIMER:
+                    timer_armed = false;
+                    return;
+
+                case URING_STOP:
+                    uring_cancel(ring, server_socket, URING_ACCEPT);
+                    return;
+                }
+            }, MAX_EVENTS);
+
+            // Receives last: sends that completed in this batch are off the queues, so new output
+            // only counts against a connection's limit behind a send the socket hasn't taken yet
+            for (const io_uring_cqe& cqe : received) {
+                on_receive(cqe);
+            }
+            received.clear();
+        }
+
+        // Stopped: cancel every request still posted (receives, sends, the timer), cut off whoever
+        // is still connected after the drain, and let the ring go
+        if (io_uring_sqe* sqe = ring.get_sqe()) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+            sqe->user_data = uring_tag(URING_CANCEL, 0);
+        }
+        ring.submit(0);
+        for (auto& [fd, us] : sessions) {
+            session_end(us.session);
+        }
+        current_loop = nullptr;
+    }
+
+    // Returns false when the kernel can't run the io_uring loops, so the caller can fall back
+    bool run_uring(const std::vector<int>& listeners) {
+        {
+            IoRing probe(uring_stats);
+            if (!probe.init(URING_ENTRIES, URING_BUFFERS, URING_BUFFER_SIZE, 0)) {
+                std::cerr << "io_uring unavailable (" << strerror(errno) << ")" << std::endl;
+                return false;
+            }
+        }
+
+        size_t loops = listeners.size();
+        std::cout << "io_uring mode with " << loops << " event loop(s)" << std::endl;
+
+        std::vector<std::unique_ptr<UringLoop>> rings;
+        for (size_t i = 0; i < loops; ++i) {
+            rings.push_back(std::make_unique<UringLoop>());
+            rings.back()->wake_fd = eventfd(0, EFD_CLOEXEC);
+            if (rings.back()->wake_fd < 0) {
+                perror("eventfd");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < loops; ++i) {
+            threads.emplace_back(uring_loop, listeners[i], rings[i].get());
+        }
+        uring_loop(listeners[0], rings[0].get());
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return true;
+    }
+#endif
 
+// Metrics in the Prometheus text format
 
+    std::string render_metrics() {
+        std::ostringstream out;
 
+        for (size_t i = 0; i < NUM_COMMANDS; ++i) {
+            const char* name = command_name(CommandType(i));
+            if (name[0] == '/') ++name;
+            write_metric(out, "chat_commands_total", "counter", "command=\"" + std::string(name) + "\"",
+                         server_metrics.commands[i].value(), i == 0);
+        }
 
+        write_metric(out, "chat_connections", "gauge", "", server_metrics.connections.value());
+        write_metric(out, "chat_logins_total", "counter", "", server_metrics.logins.value());
+        write_metric(out, "chat_auth_failures_total", "counter", "", server_metrics.auth_failures.value());
+        write_metric(out, "chat_binary_logins_total", "counter", "", server_metrics.binary_logins.value());
+        write_metric(out, "chat_bytes_in_total", "counter", "", server_metrics.bytes_in.value());
+        write_metric(out, "chat_bytes_out_total", "counter", "", outbound_stats.bytes_out.value());
+        write_metric(out, "chat_socket_writes_total", "counter", "", outbound_stats.writes.value());
+        write_metric(out, "chat_outbound_dropped_total", "counter", "", outbound_stats.dropped.value());
+        write_metric(out, "chat_slow_disconnects_total", "counter", "", outbound_stats.disconnects.value());
+
+        if (workers) {
+            const WorkerPool::Stats& pool = workers->stats();
+            write_metric(out, "chat_workers", "gauge", "", workers->size());
+            write_metric(out, "chat_worker_queued_tasks", "gauge", "", workers->pending());
+            write_metric(out, "chat_worker_tasks_total", "counter", "", pool.tasks.value());
+            write_metric(out, "chat_worker_steals_total", "counter", "", pool.steals.value());
+            write_metric(out, "chat_worker_full_waits_total", "counter", "", pool.full_waits.value());
+        }
 
+#ifdef CHAT_IO_URING
+        write_metric(out, "chat_uring_enters_total", "counter", "", uring_stats.enters.value());
+        write_metric(out, "chat_uring_sqes_total", "counter", "", uring_stats.sqes.value());
+        write_metric(out, "chat_uring_nobufs_total", "counter", "", uring_stats.nobufs.value());
+#endif
+
+        if (mailboxes) {
+            const MailboxStore::Stats& mail = mailboxes->stats();
+            write_metric(out, "chat_mailbox_bytes", "gauge", "", mail.bytes.value());
+            write_metric(out, "chat_mailbox_messages", "gauge", "", mail.messages.value());
+            write_metric(out, "chat_mailbox_stored_total", "counter", "", mail.stored.value());
+            write_metric(out, "chat_mailbox_spilled_total", "counter", "", mail.spilled.value());
+            write_metric(out, "chat_mailbox_dropped_total", "counter", "", mail.dropped.value());
+            write_metric(out, "chat_mailbox_delivered_total", "counter", "", mail.delivered.value());
+        }
 
+        if (rate_limits) {
+            bool first = true;
+            for (CommandType type : {CommandType::BROADCAST, CommandType::MSG, CommandType::GROUP_MSG}) {
+                write_metric(out, "chat_rate_limited_total", "counter", "scope=\"user\",command=\"" + std::string(command_name(type) + 1) + "\"",
+                             server_metrics.user_rate_limited[size_t(type)].value(), first);
+                first = false;
+            }
+            write_metric(out, "chat_rate_limited_total", "counter", "scope=\"group\",command=\"group_msg\"",
+                         server_metrics.group_rate_limited.value(), false);
+        }
 
+        if (message_log) {
+            const MessageLog::Stats& log = message_log->stats();
+            write_metric(out, "chat_log_records_total", "counter", "", log.records.value());
+            write_metric(out, "chat_log_bytes_total", "counter", "", log.bytes.value());
+            write_metric(out, "chat_log_commits_total", "counter", "", log.commits.value());
+            write_metric(out, "chat_log_dropped_total", "counter", "", log.dropped.value());
+            write_summary_ns(out, "chat_log_commit_seconds", "", log.commit_ns);
+        }
 
+        bool header = true;
+        for (const BufferPool::ClassStats& cls : recv_buffers.stats()) {
+            std::string size = "size=\"" + std::to_string(cls.size) + "\"";
+            write_metric(out, "chat_recv_buffers", "gauge", size + ",state=\"in_use\"", cls.in_use, header);
+            write_metric(out, "chat_recv_buffers", "gauge", size + ",state=\"free\"", cls.free, false);
+            header = false;
+        }
 
+        write_metric(out, "chat_payload_allocations_total", "counter", "", payload_stats.allocations.value());
+        write_metric(out, "chat_payload_bytes_total", "counter", "", payload_stats.bytes.value());
+        write_metric(out, "chat_payload_deliveries_total", "counter", "", payload_stats.deliveries.value());
 
+        write_summary_ns(out, "chat_lock_wait_seconds", "store=\"groups\"", server_metrics.groups_lock_wait);
 
+        write_summary_ns(out, "chat_fanout_seconds", "kind=\"broadcast\"", server_metrics.broadcast_fanout);
+        write_summary_ns(out, "chat_fanout_seconds", "kind=\"group\"", server_metrics.group_fanout, false);
 
+        const CredentialStore::Stats& auth = credentials->stats();
+        write_metric(out, "chat_users", "gauge", "", credentials->size());
+        write_metric(out, "chat_credential_reloads_total", "counter", "", auth.reloads.value());
+        write_summary_ns(out, "chat_auth_lookup_seconds", "", auth.lookup_ns);
 
+        return out.str();
+    }
 
+// Serve the metrics over plain HTTP on a loopback-only port, one scrape at a time.
+// Any request gets the full page; the endpoint is meant for curl and Prometheus.
 
+    void serve_metrics(int port) {
+        int metrics_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
 
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
 
+        int opt = 1;
+        setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        if (bind(metrics_socket, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(metrics_socket, 16) < 0) {
+            perror("Metrics endpoint");
+            close(metrics_socket);
+            return;
+        }
+        std::cout << "Metrics on http://127.0.0.1:" << port << "/metrics" << std::endl;
 
+        while (true) {
+            int scraper = accept(metrics_socket, nullptr, nullptr);
+            if (scraper < 0) {
+                if (errno != EINTR) perror("Metrics accept");
+                continue;
+            }
 
+            // Don't let a silent scraper hold up the next one
+            timeval timeout{1, 0};
+            setsockopt(scraper, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(scraper, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            char request[1024];
+            recv(scraper, request, sizeof(request), 0); // Request line and headers are ignored
+
+            std::string body = render_metrics();
+            std::string response = "HTTP/1.0 200 OK\r\n"
+                                   "Content-Type: text/plain; version=0.0.4\r\n"
+                                   "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                                   "Connection: close\r\n\r\n" + body;
+            for (size_t sent = 0; sent < response.size(); ) {
+                ssize_t n = send(scraper, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0) break;
+                sent += n;
+            }
+            close(scraper);
+        }
+    }
 
 
 
+// Graceful shutdown: stop accepting, tell every logged-in client to reconnect (each after a
+// different delay, so they don't all come back at once), then half-close each connection as
+// soon as its outbound queue has been sent and wait for the clients to hang up, for at most
+// the drain timeout. Commands keep running meanwhile. When no other process took the
+// listening sockets over, they are shut down right away so new connections are refused
+// instead of waiting in a queue nobody accepts from.
 
+    void stop_server(std::string_view reason, bool handed_off) {
+        if (stopping.exchange(true)) return;
+        eventfd_write(stop_fd, 1);
+        std::cout << reason << " Draining connections for up to " << drain_timeout_s << " s" << std::endl;
 
+        if (!handed_off) {
+            for (int server_socket : listen_sockets) {
+                shutdown(server_socket, SHUT_RD);
+            }
+        }
 
+        connections.for_each([&](uint32_t index, const std::shared_ptr<Connection>& client) {
+            send_message(*client, {reason, " Please reconnect in ", std::to_string(1 + index % RECONNECT_SPREAD_S), " s."});
+        });
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(drain_timeout_s);
+        while (std::chrono::steady_clock::now() < deadline) {
+            bool open = false;
+            connections.for_each([&](uint32_t, const std::shared_ptr<Connection>& client) {
+                client->out.finish(); // The client reads everything queued, then EOF, and hangs up
+                open = true;
+            });
+            if (!open) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(STOP_POLL_MS));
+        }
 
+        stopped = true;
+        stopped.notify_all();
+    }
 
+// Binary upgrades without a gap in accepting: a new server started with --takeover PATH connects
+// to the --handoff PATH socket of the running one and is sent its listening sockets (SCM_RIGHTS).
+// The new process accepts on them from then on, the old one stops accepting and drains its own
+// clients, whose reconnect hints spread them out over the new process.
+
+    bool send_fds(int sock, const std::vector<int>& fds) {
+        uint32_t count = fds.size();
+        iovec iov{&count, sizeof(count)};
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+        return sendmsg(sock, &msg, MSG_NOSIGNAL) == ssize_t(sizeof(count));
+    }
 
+    bool unix_address(const std::string& path, sockaddr_un& addr) {
+        addr = sockaddr_un{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "Handoff socket path too long: " << path << std::endl;
+            return false;
+        }
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
 
+    void handoff_loop(std::string path, std::vector<int> listeners) {
+        sockaddr_un addr;
+        if (!unix_address(path, addr)) return;
+        int handoff_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        unlink(path.c_str());
+        if (handoff_socket < 0 || bind(handoff_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(handoff_socket, 1) < 0) {
+            perror("Handoff socket");
+            if (handoff_socket >= 0) close(handoff_socket);
+            return;
+        }
 
+        while (!stopping) {
+            int peer = accept4(handoff_socket, nullptr, nullptr, SOCK_CLOEXEC);
+            if (peer < 0) {
+                if (errno != EINTR) perror("Handoff accept");
+                continue;
+            }
+            unlink(path.c_str()); // Before the new server binds its own socket at the same path
+            bool sent = send_fds(peer, listeners);
+            close(peer);
+            if (sent) {
+                close(handoff_socket);
+                stop_server("Server is restarting.", true);
+                return;
+            }
+            perror("Handoff");
+        }
+    }
 
+    // The listening sockets of the server at path, empty on failure
+    std::vector<int> take_over(const std::string& path) {
+        sockaddr_un addr;
+        if (!unix_address(path, addr)) return {};
+        int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("Takeover connect");
+            if (sock >= 0) close(sock);
+            return {};
+        }
 
+        uint32_t count = 0;
+        iovec iov{&count, sizeof(count)};
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS));
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+        close(sock);
+
+        std::vector<int> fds;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                fds.resize((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+                memcpy(fds.data(), CMSG_DATA(cmsg), sizeof(int) * fds.size());
+            }
+        }
+        if (n != ssize_t(sizeof(count)) || fds.empty() || fds.size() != count || (msg.msg_flags & MSG_CTRUNC)) {
+            std::cerr << "Takeover from " << path << " failed" << std::endl;
+            for (int fd : fds) close(fd);
+            return {};
+        }
+        return fds;
+    }
 
+// Signals are handled synchronously on one thread: SIGUSR1 dumps the metrics to stdout,
+// SIGHUP reloads the credential and rate limit files, SIGTERM and SIGINT stop the server gracefully (a second
+// one stops it at once)
 
+    void signal_loop(sigset_t signals) {
+        while (true) {
+            int sig = 0;
+            if (sigwait(&signals, &sig) != 0) continue;
 
+            if (sig == SIGUSR1) {
+                std::cout << render_metrics() << std::flush;
+            }
+            else if (sig == SIGHUP) {
+                credentials->reload();
+                if (rate_limits) reload_rate_limits();
+            }
+            else if (stopping) {
+                std::cout << "Stopping without draining" << std::endl;
+                _exit(EXIT_FAILURE);
+            }
+            else {
+                std::thread(stop_server, "Server is shutting down.", false).detach();
+            }
+        }
+    }
 
 
 
+    void usage(const char* prog) {
+        std::cerr << "Usage: " << prog << " [--mode threads|reactor|uring] [--loops N] [--listeners N] [--backlog N] [--users FILE]"
+                  << " [--queue-bytes N] [--slow-policy drop|disconnect|coalesce] [--metrics-port N]"
+                  << " [--workers N|off] [--worker-queue N] [--log-dir DIR] [--log-segment-mb N] [--log-segments N]"
+                  << " [--mailbox-bytes N] [--mailbox-total-bytes N] [--mailbox-dir DIR] [--mailbox-disk-bytes N]"
+                  << " [--drain-timeout SEC] [--handoff PATH] [--takeover PATH] [--rate-limits FILE]" << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
+    ServerConfig parse_args(int argc, char* argv[]) {
+        ServerConfig config;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--mode" && i + 1 < argc) {
+                std::string mode = argv[++i];
+                if (mode == "threads") config.mode = ServerMode::THREADS;
+                else if (mode == "reactor") config.mode = ServerMode::REACTOR;
+                else if (mode == "uring") config.mode = ServerMode::URING;
+                else usage(argv[0]);
+            }
+            else if (arg == "--loops" && i + 1 < argc) {
+                config.loops = std::atoi(argv[++i]);
+            }
+            else if (arg == "--listeners" && i + 1 < argc) {
+                config.listeners = std::atoi(argv[++i]);
+            }
+            else if (arg == "--backlog" && i + 1 < argc) {
+                config.backlog = std::max(1, std::atoi(argv[++i]));
+            }
+            else if (arg == "--users" && i + 1 < argc) {
+                config.users_file = argv[++i];
+            }
+            else if (arg == "--queue-bytes" && i + 1 < argc) {
+                config.outbound.max_bytes = std::strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--slow-policy" && i + 1 < argc) {
+                std::string policy = argv[++i];
+                if (policy == "drop") config.outbound.policy = SlowConsumerPolicy::DROP;
+                else if (policy == "disconnect") config.outbound.policy = SlowConsumerPolicy::DISCONNECT;
+                else if (policy == "coalesce") config.outbound.policy = SlowConsumerPolicy::COALESCE;
+                else usage(argv[0]);
+            }
+            else if (arg == "--workers" && i + 1 < argc) {
+                std::string workers = argv[++i];
+                config.workers = workers == "off" ? -1 : std::atoi(workers.c_str());
+            }
+            else if (arg == "--worker-queue" && i + 1 < argc) {
+                config.worker_queue = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+            }
+            else if (arg == "--log-dir" && i + 1 < argc) {
+                config.log.dir = argv[++i];
+            }
+            else if (arg == "--log-segment-mb" && i + 1 < argc) {
+                config.log.segment_bytes = std::max(1ul, std::strtoul(argv[++i], nullptr, 10)) << 20;
+            }
+            else if (arg == "--log-segments" && i + 1 < argc) {
+                config.log.max_segments = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+            }
+            else if (arg == "--mailbox-bytes" && i + 1 < argc) {
+                config.mailbox.user_bytes = std::strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--mailbox-total-bytes" && i + 1 < argc) {
+                config.mailbox.total_bytes = std::strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--mailbox-dir" && i + 1 < argc) {
+                config.mailbox.spill_dir = argv[++i];
+            }
+            else if (arg == "--mailbox-disk-bytes" && i + 1 < argc) {
+                config.mailbox.user_disk_bytes = std::strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "--metrics-port" && i + 1 < argc) {
+                config.metrics_port = std::atoi(argv[++i]);
+            }
+            else if (arg == "--drain-timeout" && i + 1 < argc) {
+                config.drain_timeout = std::max(0, std::atoi(argv[++i]));
+            }
+            else if (arg == "--handoff" && i + 1 < argc) {
+                config.handoff_path = argv[++i];
+            }
+            else if (arg == "--takeover" && i + 1 < argc) {
+                config.takeover_path = argv[++i];
+            }
+            else if (arg == "--rate-limits" && i + 1 < argc) {
+                config.rate_limits_path = argv[++i];
+            }
+            else {
+                usage(argv[0]);
+            }
+        }
+        return config;
+    }
+
+
+int main(int argc, char* argv[]) {
+    ServerConfig config = parse_args(argc, argv);
+
+    // Block the handled signals before any thread starts (workers, the log writer) so only signal_loop receives them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    outbound_limits = config.outbound;
+    drain_timeout_s = config.drain_timeout;
+
+    credentials = std::make_unique<CredentialStore>(config.users_file);
+    if (!credentials->reload()) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (config.mailbox.user_bytes > 0) {
+        if (!config.mailbox.spill_dir.empty() && mkdir(config.mailbox.spill_dir.c_str(), 0700) < 0 && errno != EEXIST) {
+            perror("Mailbox directory");
+            exit(EXIT_FAILURE);
+        }
+        mailboxes = std::make_unique<MailboxStore>(config.mailbox);
+    }
+
+    if (!config.log.dir.empty()) {
+        message_log = std::make_unique<MessageLog>(config.log);
+        if (!message_log->open()) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!config.rate_limits_path.empty()) {
+        rate_limits = std::make_unique<RateLimits>();
+        rate_limits->path = config.rate_limits_path;
+        if (!reload_rate_limits()) {
+            exit(EXIT_FAILURE);
+        }
+    }
 
+    if (config.workers >= 0) {
+        unsigned count = config.workers > 0 ? config.workers : std::max(1u, std::thread::hardware_concurrency());
+        workers = std::make_unique<WorkerPool>(count, config.worker_queue);
+        std::cout << "Running commands on " << count << " worker(s)" << std::endl;
+    }
+
+    // Thread mode gets dedicated acceptors, the event loops each accept on their own socket.
+    // Taking over from a running server means one acceptor or loop per socket it had.
+    std::vector<int>& listeners = listen_sockets;
+    if (!config.takeover_path.empty()) {
+        listeners = take_over(config.takeover_path);
+        if (listeners.empty()) {
+            exit(EXIT_FAILURE);
+        }
+        std::cout << "Took over " << listeners.size() << " listening socket(s) from " << config.takeover_path << std::endl;
+    }
+    else {
+        unsigned count = config.mode == ServerMode::THREADS ? config.listeners : config.loops;
+        if (count == 0) {
+            count = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned i = 0; i < count; ++i) {
+            listeners.push_back(open_listener(config.backlog));
+        }
+    }
 
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd < 0) {
+        perror("eventfd");
+        exit(EXIT_FAILURE);
+    }
 
+    std::thread(signal_loop, signals).detach();
+    std::thread(&CredentialStore::watch, credentials.get()).detach();
+    if (config.metrics_port > 0) {
+        std::thread(serve_metrics, config.metrics_port).detach();
+    }
+    if (!config.handoff_path.empty()) {
+        std::thread(handoff_loop, config.handoff_path, listeners).detach();
+    }
 
+    std::cout << "Server is listening on port " << PORT << std::endl;
+
+
+
+    if (config.mode == ServerMode::URING) {
+#ifdef CHAT_IO_URING
+        bool ran = run_uring(listeners);
+#else
+        bool ran = false;
+        std::cerr << "Built without io_uring support (make URING=1)" << std::endl;
+#endif
+        if (!ran) {
+            std::cerr << "Falling back to reactor mode" << std::endl;
+            run_reactor(listeners);
+        }
+    }
+    else if (config.mode == ServerMode::REACTOR) {
+        run_reactor(listeners);
+    }
+    else {
+        run_threads(listeners);
+    }
+
+    // The event loops return once the drain is over, thread mode's acceptors as soon as it starts
+    stopped.wait(false);
+    if (message_log) {
+        message_log->sync();
+    }
+    for (int server_socket : listeners) {
+        close(server_socket);  // Proper cleanup
+    }
+    std::cout << "Server stopped" << std::endl;
+
+    // Workers, the log writer and leftover client threads are parked on the globals, so leave
+    // without running their destructors
+    _exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,392 @@
+// Sharded, reader-writer state store for the chat server.
+//
+// Keys are hash-partitioned over independent shards, each guarded by its own
+// std::shared_mutex: lookups take a shared lock on one shard, updates lock only the
+// shard they touch. Users and groups are interned into dense IDs that index slot tables,
+// so the hot paths (finding a recipient, walking a group) need neither a hash nor a shard
+// lock.
+// Group membership is published as an immutable snapshot, so fan-out iterates members
+// without holding any group lock. Contended lock acquisitions can be timed into a
+// Histogram to see how long threads wait on the store.
+
+#ifndef STATE_STORE_H
+#define STATE_STORE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "metrics.h"
+
+#define STATE_SHARDS 64
+
+// String keys hash through std::string_view, so lookups can take a view of the key
+// (e.g. straight out of a parsed command) without building a std::string first
+
+template <typename Key>
+struct ShardHash : std::hash<Key> {};
+
+template <>
+struct ShardHash<std::string> {
+    using is_transparent = void;
+    size_t operator()(std::string_view key) const { return std::hash<std::string_view>{}(key); }
+};
+
+template <typename Key, typename Value, size_t Shards = STATE_SHARDS>
+class ShardedMap {
+public:
+    explicit ShardedMap(Histogram* lock_wait = nullptr) : lock_wait_(lock_wait) {}
+
+    // Insert only if the key is absent, returns false if it already existed
+    bool insert(const Key& key, Value value) {
+        Shard& s = shard_for(key);
+        std::unique_lock<std::shared_mutex> lock(s.mtx, std::defer_lock);
+        acquire(lock);
+        return s.map.emplace(key, std::move(value)).second;
+    }
+
+    void insert_or_assign(const Key& key, Value value) {
+        Shard& s = shard_for(key);
+        std::unique_lock<std::shared_mutex> lock(s.mtx, std::defer_lock);
+        acquire(lock);
+        s.map.insert_or_assign(key, std::move(value));
+    }
+
+    bool erase(const Key& key) {
+        Shard& s = shard_for(key);
+        std::unique_lock<std::shared_mutex> lock(s.mtx, std::defer_lock);
+        acquire(lock);
+        return s.map.erase(key) > 0;
+    }
+
+    // Erase only while the key still maps to expected (a newer login may have replaced it)
+    bool erase_if_equal(const Key& key, const Value& expected) {
+        Shard& s = shard_for(key);
+        std::unique_lock<std::shared_mutex> lock(s.mtx, std::defer_lock);
+        acquire(lock);
+        auto it = s.map.find(key);
+        if (it == s.map.end() || !(it->second == expected)) return false;
+        s.map.erase(it);
+        return true;
+    }
+
+    template <typename K>
+    bool contains(const K& key) const {
+        const Shard& s = shard_for(key);
+        std::shared_lock<std::shared_mutex> lock(s.mtx, std::defer_lock);
+        acquire(lock);
+        return s.map.find(key) != s.map.end();
+    }
+
+    // Call f(const Value&) under the shard's shared lock, returns false if the key is absent
+    template <typename K, typename F>
+    bool visit(const K& key, F&& f) const {
+        const Shard& s = shard_for(key);
+        std::shared_lock<std::shared_mutex> lock(s.mtx, std::defer_lock);
+        acquire(lock);
+        auto it = s.map.find(key);
+        if (it == s.map.end()) return false;
+        f(it->second);
+        return true;
+    }
+
+    // Call f(Value&) under the shard's exclusive lock, returns false if the key is absent
+    template <typename K, typename F>
+    bool update(const K& key, F&& f) {
+        Shard& s = shard_for(key);
+        std::unique_lock<std::shared_mutex> lock(s.mtx, std::defer_lock);
+        acquire(lock);
+        auto it = s.map.find(key);
+        if (it == s.map.end()) return false;
+        f(it->second);
+        return true;
+    }
+
+    // Call f(Value&) under the shard's exclusive lock, default-constructing the value if absent
+    template <typename K, typename F>
+    void upsert(const K& key, F&& f) {
+        Shard& s = shard_for(key);
+        std::unique_lock<std::shared_mutex> lock(s.mtx, std::defer_lock);
+        acquire(lock);
+        auto it = s.map.find(key);
+        if (it == s.map.end()) it = s.map.emplace(Key(key), Value()).first;
+        f(it->second);
+    }
+
+    // Call f(const Key&, const Value&) for every entry, one shard (shared lock) at a time
+    template <typename F>
+    void for_each(F&& f) const {
+        for (const Shard& s : shards_) {
+            std::shared_lock<std::shared_mutex> lock(s.mtx, std::defer_lock);
+            acquire(lock);
+            for (const auto& entry : s.map) {
+                f(entry.first, entry.second);
+            }
+        }
+    }
+
+private:
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mtx;
+        std::unordered_map<Key, Value, ShardHash<Key>, std::equal_to<>> map;
+    };
+
+    // Take the lock, timing the wait only when the fast try_lock() path fails
+    template <typename Lock>
+    void acquire(Lock& lock) const {
+        if (lock.try_lock()) return;
+        if (!lock_wait_) {
+            lock.lock();
+            return;
+        }
+        uint64_t start = metrics_now_ns();
+        lock.lock();
+        lock_wait_->record(metrics_now_ns() - start);
+    }
+
+    template <typename K>
+    Shard& shard_for(const K& key) { return shards_[ShardHash<Key>{}(key) % Shards]; }
+    template <typename K>
+    const Shard& shard_for(const K& key) const { return shards_[ShardHash<Key>{}(key) % Shards]; }
+
+    std::array<Shard, Shards> shards_;
+    Histogram* lock_wait_;
+};
+
+// Dense table of shared objects indexed by small integer IDs (interned users and groups,
+// connection slots). Storage grows in chunks that never move and every slot is an
+// std::atomic<std::shared_ptr>, so readers index straight into it without a hash or a
+// shard lock. That is not lock-free: libstdc++ guards each slot with its own tiny
+// spinlock, held just long enough to copy the pointer and bump the reference count, so
+// readers only ever wait on someone touching the same slot.
+
+#define SLOT_CHUNK_BITS 12
+#define SLOT_CHUNKS 1024 // Up to 4M IDs
+
+template <typename T>
+class SlotTable {
+public:
+    SlotTable() = default;
+    ~SlotTable() {
+        for (auto& chunk : chunks_) delete chunk.load(std::memory_order_relaxed);
+    }
+
+    SlotTable(const SlotTable&) = delete;
+    SlotTable& operator=(const SlotTable&) = delete;
+
+    // Number of slots, IDs run from 0 to capacity() - 1
+    static constexpr uint32_t capacity() { return uint32_t(SLOT_CHUNKS) << SLOT_CHUNK_BITS; }
+
+    // Value in slot id, nullptr if empty
+    std::shared_ptr<T> load(uint32_t id) const {
+        if (id >= capacity()) return nullptr;
+        const Chunk* chunk = chunks_[id >> SLOT_CHUNK_BITS].load(std::memory_order_acquire);
+        return chunk ? (*chunk)[id & CHUNK_MASK].load(std::memory_order_acquire) : nullptr;
+    }
+
+    // False, and nothing stored, if id is past capacity()
+    bool store(uint32_t id, std::shared_ptr<T> value) {
+        std::atomic<std::shared_ptr<T>>* s = slot(id);
+        if (!s) return false;
+        s->store(std::move(value), std::memory_order_release);
+        return true;
+    }
+
+    // Replace the value only while the slot still holds expected (a newer login may have replaced it)
+    bool replace_if_equal(uint32_t id, std::shared_ptr<T> expected, std::shared_ptr<T> desired) {
+        std::atomic<std::shared_ptr<T>>* s = slot(id);
+        return s && s->compare_exchange_strong(expected, std::move(desired));
+    }
+
+    // Call f(uint32_t id, const std::shared_ptr<T>&) for every occupied slot, in ID order
+    template <typename F>
+    void for_each(F&& f) const {
+        uint32_t end = end_.load(std::memory_order_acquire);
+        for (uint32_t id = 0; id < end;) {
+            const Chunk* chunk = chunks_[id >> SLOT_CHUNK_BITS].load(std::memory_order_acquire);
+            uint32_t stop = std::min(end, (id | CHUNK_MASK) + 1);
+            for (; chunk && id < stop; ++id) {
+                std::shared_ptr<T> value = (*chunk)[id & CHUNK_MASK].load(std::memory_order_acquire);
+                if (value) f(id, value);
+            }
+            id = stop;
+        }
+    }
+
+private:
+    static constexpr uint32_t CHUNK_MASK = (1u << SLOT_CHUNK_BITS) - 1;
+    using Chunk = std::array<std::atomic<std::shared_ptr<T>>, size_t(1) << SLOT_CHUNK_BITS>;
+
+    // Slot for writing, allocating its chunk on first use; nullptr past capacity()
+    std::atomic<std::shared_ptr<T>>* slot(uint32_t id) {
+        if (id >= capacity()) return nullptr;
+        std::atomic<Chunk*>& entry = chunks_[id >> SLOT_CHUNK_BITS];
+        Chunk* chunk = entry.load(std::memory_order_acquire);
+        if (!chunk) {
+            std::lock_guard<std::mutex> lock(grow_mtx_);
+            chunk = entry.load(std::memory_order_relaxed);
+            if (!chunk) {
+                chunk = new Chunk();
+                entry.store(chunk, std::memory_order_release);
+            }
+        }
+        uint32_t end = end_.load(std::memory_order_relaxed);
+        while (end <= id && !end_.compare_exchange_weak(end, id + 1, std::memory_order_release)) {}
+        return &(*chunk)[id & CHUNK_MASK];
+    }
+
+    std::array<std::atomic<Chunk*>, SLOT_CHUNKS> chunks_{};
+    std::atomic<uint32_t> end_{0}; // One past the highest slot ever written
+    std::mutex grow_mtx_;
+};
+
+// Hands out the lowest free slot number, so slot tables stay dense as connections come and go
+
+class SlotAllocator {
+public:
+    uint32_t acquire() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (free_.empty()) return next_++;
+        std::pop_heap(free_.begin(), free_.end(), std::greater<>());
+        uint32_t slot = free_.back();
+        free_.pop_back();
+        return slot;
+    }
+
+    void release(uint32_t slot) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        free_.push_back(slot);
+        std::push_heap(free_.begin(), free_.end(), std::greater<>());
+    }
+
+private:
+    std::mutex mtx_;
+    std::vector<uint32_t> free_; // Min-heap
+    uint32_t next_ = 0;
+};
+
+// Dense IDs for names (users, groups), handed out in order starting at 1 and never reused,
+// so a name's ID stays valid for the life of the server. Looking up the name behind an ID
+// is one SlotTable load, and the views returned by name() stay valid too. IDs index SlotTables,
+// so there are at most SlotTable capacity() - 1 of them.
+
+class InternTable {
+public:
+    // ID of name, assigned on first use; 0 if name is new and the table is full
+    uint32_t intern(std::string_view name) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mtx_);
+            auto it = ids_.find(name);
+            if (it != ids_.end()) return it->second;
+        }
+        std::unique_lock<std::shared_mutex> lock(mtx_);
+        auto it = ids_.find(name);
+        if (it != ids_.end()) return it->second;
+        uint32_t id = uint32_t(ids_.size()) + 1;
+        if (id >= SlotTable<const std::string>::capacity()) return 0;
+        auto stored = std::make_shared<const std::string>(name);
+        ids_.emplace(*stored, id);
+        names_.store(id, std::move(stored));
+        return id;
+    }
+
+    // ID of name, 0 if it was never interned
+    uint32_t find(std::string_view name) const {
+        std::shared_lock<std::shared_mutex> lock(mtx_);
+        auto it = ids_.find(name);
+        return it == ids_.end() ? 0 : it->second;
+    }
+
+    // Name of id, empty if there is no such ID
+    std::string_view name(uint32_t id) const {
+        std::shared_ptr<const std::string> stored = names_.load(id);
+        return stored ? std::string_view(*stored) : std::string_view(); // The table keeps the string alive
+    }
+
+private:
+    mutable std::shared_mutex mtx_; // Guards ids_
+    std::unordered_map<std::string_view, uint32_t> ids_; // Views into the names
+    SlotTable<const std::string> names_;
+};
+
+// Groups by interned group ID with copy-on-write membership: a sorted vector of user IDs
+// that is replaced, never modified, so fan-out reads a consistent snapshot with one atomic
+// load and walks contiguous IDs. Changes to one group are serialised by a striped lock.
+
+using MemberList = std::shared_ptr<const std::vector<uint32_t>>;
+
+enum class MembershipResult { OK, NO_GROUP, ALREADY_MEMBER, NOT_MEMBER };
+
+class GroupTable {
+public:
+    explicit GroupTable(Histogram* lock_wait = nullptr) : lock_wait_(lock_wait) {}
+
+    // Create a group with the creator as its only member, false if it already exists
+    bool create(uint32_t group, uint32_t creator) {
+        std::unique_lock<std::mutex> lock = lock_group(group);
+        if (groups_.load(group)) return false;
+        groups_.store(group, std::make_shared<const std::vector<uint32_t>>(1, creator));
+        return true;
+    }
+
+    MembershipResult join(uint32_t group, uint32_t user) {
+        std::unique_lock<std::mutex> lock = lock_group(group);
+        MemberList members = groups_.load(group);
+        if (!members) return MembershipResult::NO_GROUP;
+
+        auto pos = std::lower_bound(members->begin(), members->end(), user);
+        if (pos != members->end() && *pos == user) return MembershipResult::ALREADY_MEMBER;
+        auto next = std::make_shared<std::vector<uint32_t>>(*members);
+        next->insert(next->begin() + (pos - members->begin()), user);
+        groups_.store(group, std::move(next));
+        return MembershipResult::OK;
+    }
+
+    MembershipResult leave(uint32_t group, uint32_t user) {
+        std::unique_lock<std::mutex> lock = lock_group(group);
+        MemberList members = groups_.load(group);
+        if (!members) return MembershipResult::NO_GROUP;
+
+        auto pos = std::lower_bound(members->begin(), members->end(), user);
+        if (pos == members->end() || *pos != user) return MembershipResult::NOT_MEMBER;
+        auto next = std::make_shared<std::vector<uint32_t>>(*members);
+        next->erase(next->begin() + (pos - members->begin()));
+        groups_.store(group, std::move(next));
+        return MembershipResult::OK;
+    }
+
+    // Current members of the group, nullptr if it does not exist
+    MemberList members(uint32_t group) const {
+        return groups_.load(group);
+    }
+
+    static bool is_member(const MemberList& members, uint32_t user) {
+        return std::binary_search(members->begin(), members->end(), user);
+    }
+
+private:
+    // Take the group's writer lock, timing the wait only when try_lock() fails
+    std::unique_lock<std::mutex> lock_group(uint32_t group) {
+        std::unique_lock<std::mutex> lock(writers_[group % STATE_SHARDS], std::try_to_lock);
+        if (lock.owns_lock()) return lock;
+        uint64_t start = metrics_now_ns();
+        lock.lock();
+        if (lock_wait_) lock_wait_->record(metrics_now_ns() - start);
+        return lock;
+    }
+
+    SlotTable<const std::vector<uint32_t>> groups_;
+    std::array<std::mutex, STATE_SHARDS> writers_;
+    Histogram* lock_wait_;
+};
+
+#endif // STATE_STORE_H
@@ -0,0 +1,228 @@
+// Minimal io_uring ring for the chat server's uring mode.
+//
+// Talks to the kernel with the raw io_uring_setup/io_uring_enter/io_uring_register
+// system calls and <linux/io_uring.h>, so the build needs no liburing. Besides the
+// submission and completion rings it sets up one provided-buffer ring: a set of
+// receive buffers registered with the kernel once, from which multishot receives pick
+// a buffer per completion, so no buffer has to be handed to any single connection.
+//
+// A ring is meant to be used by the one thread that created it (IORING_SETUP_SINGLE_ISSUER).
+
+#ifndef URING_H
+#define URING_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+class IoRing {
+public:
+    // Shared by every ring
+    struct Stats {
+        Counter enters;  // io_uring_enter() calls
+        Counter sqes;    // Requests submitted through them
+        Counter nobufs;  // Multishot receives stopped because every provided buffer was in use
+    };
+
+    explicit IoRing(Stats& stats) : stats_(stats) {}
+    ~IoRing() { destroy(); }
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // Create the ring and register buffer_count receive buffers of buffer_size bytes as
+    // provided-buffer group group. Returns false with errno set when the kernel is too old
+    // (single-issuer rings and multishot receive both need Linux 6.0) or io_uring is disabled.
+    bool init(unsigned entries, unsigned buffer_count, unsigned buffer_size, uint16_t group) {
+        io_uring_params params{};
+        params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+        params.cq_entries = entries * 4; // Multishot requests post many completions per submission
+        fd_ = int(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0) return false;
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+            destroy();
+            errno = ENOSYS;
+            return false;
+        }
+
+        ring_size_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                              params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        ring_ = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (ring_ == MAP_FAILED || sqes == MAP_FAILED) {
+            int saved = errno;
+            if (sqes != MAP_FAILED) munmap(sqes, sqes_size_);
+            destroy();
+            errno = saved;
+            return false;
+        }
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        char* base = static_cast<char*>(ring_);
+        sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+
+        // SQ slot i always holds SQE i, so the index array never changes after this
+        unsigned* array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+        for (unsigned i = 0; i < sq_entries_; ++i) array[i] = i;
+        sqe_tail_ = *sq_tail_;
+
+        return setup_buffers(buffer_count, buffer_size, group);
+    }
+
+    // Next free submission entry, zeroed. Submits what is queued when the ring is full.
+    io_uring_sqe* get_sqe() {
+        unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sqe_tail_ - head >= sq_entries_) {
+            submit(0);
+            head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+            if (sqe_tail_ - head >= sq_entries_) return nullptr;
+        }
+        io_uring_sqe* sqe = &sqes_[sqe_tail_ & sq_mask_];
+        std::memset(sqe, 0, sizeof(*sqe));
+        ++sqe_tail_;
+        return sqe;
+    }
+
+    // Hand every queued request to the kernel in one system call and wait for at least
+    // wait_for completions. Returns the number submitted, or -errno.
+    int submit(unsigned wait_for) {
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+        unsigned pending = sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+
+        unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+        if (pending == 0 && wait_for == 0) return 0;
+        while (true) {
+            int n = int(syscall(__NR_io_uring_enter, fd_, pending, wait_for, flags, nullptr, 0));
+            stats_.enters.add();
+            if (n >= 0) {
+                stats_.sqes.add(n);
+                return n;
+            }
+            if (errno != EINTR) return -errno;
+            if (wait_for > 0 && ready()) return 0;
+        }
+    }
+
+    // Call f(const io_uring_cqe&) for up to max of the completions posted so far, returns how many
+    template <typename F>
+    unsigned for_each_completion(F&& f, unsigned max) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        unsigned count = std::min(tail - head, max);
+        tail = head + count;
+        for (; head != tail; ++head) {
+            io_uring_cqe cqe = cqes_[head & cq_mask_];
+            __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE); // f() may queue more requests
+            f(cqe);
+        }
+        return count;
+    }
+
+    // Provided receive buffer picked by the kernel for a completion with IORING_CQE_F_BUFFER
+    static uint16_t buffer_id(const io_uring_cqe& cqe) { return uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT); }
+    char* buffer(uint16_t id) const { return buffers_ + size_t(id) * buffer_size_; }
+
+    // Give a provided buffer back to the kernel once its bytes have been consumed
+    void recycle(uint16_t id) {
+        // Not buf_ring_->bufs: in C++ the header's flexible-array wrapper shifts it by 8 bytes
+        io_uring_buf& slot = reinterpret_cast<io_uring_buf*>(buf_ring_)[buf_tail_ & buf_mask_];
+        slot.addr = reinterpret_cast<uint64_t>(buffer(id));
+        slot.len = buffer_size_;
+        slot.bid = id;
+        ++buf_tail_;
+        __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+    }
+
+    uint16_t buffer_group() const { return group_; }
+
+    // Completions waiting to be processed
+    bool ready() const { return *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE); }
+
+    void note_nobufs() { stats_.nobufs.add(); }
+
+private:
+    bool setup_buffers(unsigned count, unsigned size, uint16_t group) {
+        // The buffer ring needs a power-of-two number of entries, page aligned
+        buf_mask_ = count - 1;
+        buf_ring_size_ = count * sizeof(io_uring_buf);
+        buffers_size_ = size_t(count) * size;
+        void* ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        void* buffers = mmap(nullptr, buffers_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED || buffers == MAP_FAILED) {
+            int saved = errno;
+            if (ring != MAP_FAILED) munmap(ring, buf_ring_size_);
+            if (buffers != MAP_FAILED) munmap(buffers, buffers_size_);
+            errno = saved;
+            return false;
+        }
+        buf_ring_ = static_cast<io_uring_buf_ring*>(ring);
+        buffers_ = static_cast<char*>(buffers);
+        buffer_size_ = size;
+        group_ = group;
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return false;
+
+        for (unsigned id = 0; id < count; ++id) recycle(uint16_t(id));
+        return true;
+    }
+
+    void destroy() {
+        if (sqes_) munmap(sqes_, sqes_size_);
+        if (ring_ && ring_ != MAP_FAILED) munmap(ring_, ring_size_);
+        if (fd_ >= 0) close(fd_); // Also drops the buffer ring registration
+        if (buf_ring_) munmap(buf_ring_, buf_ring_size_);
+        if (buffers_) munmap(buffers_, buffers_size_);
+        sqes_ = nullptr;
+        ring_ = nullptr;
+        buf_ring_ = nullptr;
+        buffers_ = nullptr;
+        fd_ = -1;
+    }
+
+    Stats& stats_;
+    int fd_ = -1;
+
+    void* ring_ = nullptr; // SQ and CQ rings share one mapping
+    size_t ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sqe_tail_ = 0; // Entries handed out by get_sqe(), published to *sq_tail_ by submit()
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    io_uring_buf_ring* buf_ring_ = nullptr;
+    size_t buf_ring_size_ = 0;
+    char* buffers_ = nullptr;
+    size_t buffers_size_ = 0;
+    unsigned buffer_size_ = 0;
+    unsigned buf_mask_ = 0;
+    uint16_t buf_tail_ = 0;
+    uint16_t group_ = 0;
+};
+
+#endif // URING_H
@@ -0,0 +1,196 @@
+// Fixed pool of command workers for the chat server.
+//
+// Each connection owns a Mailbox and is pinned to a home worker, picked round-robin when
+// the connection opens. Submitting a task appends it to the mailbox; a mailbox with work
+// is put on its home worker's run queue, and only one worker drains a mailbox at a time,
+// so a connection's commands always run in the order they arrived. A worker that runs
+// out of mailboxes steals whole mailboxes from the back of a busy worker's run queue,
+// which keeps that ordering. Every worker bounds the tasks queued for its connections:
+// submit() blocks once the limit is reached, pushing back on the reading thread.
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+#define WORKER_BATCH 32 // Tasks run from one mailbox before it goes to the back of the queue
+#define WORKER_IDLE_POLL_MS 5 // How often an idle worker looks for work to steal
+
+class WorkerPool {
+public:
+    using Task = std::function<void()>;
+
+    // One connection's pending tasks
+    struct Mailbox {
+        explicit Mailbox(unsigned home) : home(home) {}
+
+        const unsigned home;
+        std::mutex mtx;
+        std::deque<Task> tasks;
+        bool scheduled = false; // On some worker's run queue or being drained
+    };
+
+    struct Stats {
+        Counter tasks;
+        Counter steals;
+        Counter full_waits; // submit() calls that blocked on a full queue
+    };
+
+    WorkerPool(unsigned workers, size_t queue_depth) : queue_depth_(queue_depth), workers_(workers) {
+        for (unsigned i = 0; i < workers; ++i) {
+            std::thread(&WorkerPool::run, this, i).detach();
+        }
+    }
+
+    // Mailbox for a new connection, pinned to the next worker in turn
+    std::shared_ptr<Mailbox> open() {
+        return std::make_shared<Mailbox>(next_home_.fetch_add(1, std::memory_order_relaxed) % workers_.size());
+    }
+
+    void submit(const std::shared_ptr<Mailbox>& mailbox, Task task) {
+        Worker& home = workers_[mailbox->home];
+        {
+            std::unique_lock<std::mutex> lock(home.mtx);
+            if (home.pending >= queue_depth_) {
+                stats_.full_waits.add();
+                home.not_full.wait(lock, [&] { return home.pending < queue_depth_; });
+            }
+            ++home.pending;
+        }
+
+        bool schedule = false;
+        {
+            std::lock_guard<std::mutex> lock(mailbox->mtx);
+            mailbox->tasks.push_back(std::move(task));
+            if (!mailbox->scheduled) {
+                mailbox->scheduled = true;
+                schedule = true;
+            }
+        }
+        if (schedule) enqueue(mailbox);
+    }
+
+    // True while submit() for this mailbox would block, for readers that must not
+    bool full(const Mailbox& mailbox) const {
+        const Worker& home = workers_[mailbox.home];
+        std::lock_guard<std::mutex> lock(home.mtx);
+        return home.pending >= queue_depth_;
+    }
+
+    size_t size() const { return workers_.size(); }
+
+    // Tasks submitted but not yet finished, over all workers
+    size_t pending() const {
+        size_t total = 0;
+        for (const Worker& w : workers_) {
+            std::lock_guard<std::mutex> lock(w.mtx);
+            total += w.pending;
+        }
+        return total;
+    }
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Worker {
+        mutable std::mutex mtx;
+        std::condition_variable wake;
+        std::condition_variable not_full;
+        std::deque<std::shared_ptr<Mailbox>> runnable;
+        size_t pending = 0; // Tasks queued in mailboxes homed here
+    };
+
+    void enqueue(const std::shared_ptr<Mailbox>& mailbox) {
+        Worker& home = workers_[mailbox->home];
+        {
+            std::lock_guard<std::mutex> lock(home.mtx);
+            home.runnable.push_back(mailbox);
+        }
+        home.wake.notify_one();
+    }
+
+    // Own queue from the front, otherwise the back of the first other queue with work
+    std::shared_ptr<Mailbox> take(unsigned self) {
+        {
+            std::lock_guard<std::mutex> lock(workers_[self].mtx);
+            if (!workers_[self].runnable.empty()) {
+                std::shared_ptr<Mailbox> mailbox = std::move(workers_[self].runnable.front());
+                workers_[self].runnable.pop_front();
+                return mailbox;
+            }
+        }
+        for (size_t i = 1; i < workers_.size(); ++i) {
+            Worker& victim = workers_[(self + i) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.mtx);
+            if (!victim.runnable.empty()) {
+                std::shared_ptr<Mailbox> mailbox = std::move(victim.runnable.back());
+                victim.runnable.pop_back();
+                stats_.steals.add();
+                return mailbox;
+            }
+        }
+        return nullptr;
+    }
+
+    void run(unsigned self) {
+        Worker& me = workers_[self];
+        while (true) {
+            std::shared_ptr<Mailbox> mailbox = take(self);
+            if (!mailbox) {
+                // Sleep until our own queue gets work, waking now and then to look for some to steal
+                std::unique_lock<std::mutex> lock(me.mtx);
+                me.wake.wait_for(lock, std::chrono::milliseconds(WORKER_IDLE_POLL_MS),
+                                 [&] { return !me.runnable.empty(); });
+                continue;
+            }
+            drain(*mailbox);
+
+            // Tasks that arrived while draining keep the mailbox scheduled, behind everyone else
+            bool more;
+            {
+                std::lock_guard<std::mutex> lock(mailbox->mtx);
+                more = !mailbox->tasks.empty();
+                mailbox->scheduled = more;
+            }
+            if (more) enqueue(mailbox);
+        }
+    }
+
+    void drain(Mailbox& mailbox) {
+        Worker& home = workers_[mailbox.home];
+        for (int n = 0; n < WORKER_BATCH; ++n) {
+            Task task;
+            {
+                std::lock_guard<std::mutex> lock(mailbox.mtx);
+                if (mailbox.tasks.empty()) break;
+                task = std::move(mailbox.tasks.front());
+                mailbox.tasks.pop_front();
+            }
+            task();
+            stats_.tasks.add();
+
+            {
+                std::lock_guard<std::mutex> lock(home.mtx);
+                --home.pending;
+            }
+            home.not_full.notify_one();
+        }
+    }
+
+    const size_t queue_depth_;
+    std::vector<Worker> workers_;
+    std::atomic<unsigned> next_home_{0};
+    Stats stats_;
+};
+
+#endif // WORKER_POOL_H
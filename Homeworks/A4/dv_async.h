@@ -0,0 +1,400 @@
+// Event-driven, asynchronous distance-vector routing.
+//
+// Unlike simulateDVR(), which runs global rounds in which every node reads every other
+// node's table, each node here only knows its own links and the last vector each
+// neighbor sent it. Everything happens through a discrete-event scheduler (a min-heap
+// on time, ties in the order scheduled):
+//
+//   - An update travels over a link with that link's delay (link delay x (1 + jitter x a
+//     random fraction), fixed per direction) and lands in the receiver's inbox.
+//   - A node processes its whole inbox at once and recomputes the destinations the updates
+//     mention. Changed entries go out in a triggered update, at most one per update
+//     delay; changes made in between wait and are sent together, as RIP does.
+//   - Link events (dynamic_routing.h scripts) change a link's cost at both ends at their
+//     time t; a link that comes up exchanges full tables, one that goes down drops the
+//     vector learnt over it and whatever is still in flight on it.
+//
+// Entries routed through the receiver are sent as they are (plain), left out (split
+// horizon) or sent as infinity (poison reverse). Since updates only carry changes, a route
+// that moves onto the receiver is withdrawn once under split horizon, where RIP would have
+// let it time out. Costs reaching infinity count as unreachable, so a count to infinity
+// ends there. Infinity is INF, raised to one more than the longest simple path can cost
+// ((n - 1) x the dearest link, events included) where that is more, as RIP's 16 would be
+// for a larger network. Updates are sized like RIP: datagrams of at most 25 entries, 4
+// header bytes plus 20 per entry.
+
+#ifndef DV_ASYNC_H
+#define DV_ASYNC_H
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dynamic_routing.h"
+#include "graph.h"
+#include "link_state.h"
+
+#define RIP_MAX_ENTRIES 25  // Entries per datagram
+#define RIP_HEADER_BYTES 4
+#define RIP_ENTRY_BYTES 20
+
+class AsyncDVSimulator {
+public:
+    enum Mode { PLAIN, SPLIT_HORIZON, POISON_REVERSE };
+
+    struct Options {
+        Mode mode = POISON_REVERSE;
+        double linkDelay = 1;     // Time an update takes over a link...
+        double jitter = 0.5;      // ...plus up to this fraction more, fixed per direction
+        double updateDelay = 0.5; // Least time between two triggered updates from a node
+        double maxTime = std::numeric_limits<double>::infinity();
+        unsigned seed = 425;
+    };
+
+    // Traffic and route changes from the start, or from one link event to the next
+    struct Phase {
+        std::string label;
+        double start = 0, lastChange = 0;
+        long datagrams = 0, entries = 0, bytes = 0, routeChanges = 0;
+    };
+
+    AsyncDVSimulator(const Graph& graph, Options options)
+        : n_(graph.n), options_(options), rng_(options.seed), nodes_(n_),
+          dist_(n_, std::vector<int>(n_)), nextHop_(n_, std::vector<int>(n_, -1)) {
+        for (int u = 0; u < n_; ++u) {
+            for (int e = graph.begin(u); e < graph.end(u); ++e) {
+                neighbor(u, graph.to[e]).cost = graph.cost[e];
+                maxCost_ = std::max(maxCost_, graph.cost[e]);
+            }
+        }
+    }
+
+    // Run until no event is left (converged) or options.maxTime passes
+    void run(const std::vector<LinkEvent>& events) {
+        for (size_t i = 0; i < events.size(); ++i) {
+            schedule(events[i].time, LINK, -1, (int)i);
+            if (events[i].cost < INF) maxCost_ = std::max(maxCost_, events[i].cost);
+        }
+
+        // Below INT_MAX / 2, a link cost can be added to any cost without overflowing
+        long longest = (long)(n_ - 1) * maxCost_;
+        infinity_ = (int)std::min<long>(std::max<long>(INF, longest + 1), INT_MAX / 2);
+        for (int x = 0; x < n_; ++x) {
+            dist_[x].assign(n_, infinity_);
+            dist_[x][x] = 0;
+            for (Neighbor& nb : nodes_[x].neighbors) {
+                nb.vector.assign(n_, infinity_);
+                nb.vector[nb.node] = 0;
+            }
+        }
+
+        // At time 0 every node works out routes to its neighbors and advertises them
+        phases_.push_back(Phase());
+        phases_.back().label = "start";
+        std::vector<int> all(n_);
+        for (int d = 0; d < n_; ++d) all[d] = d;
+        for (int x = 0; x < n_; ++x) {
+            queueChanges(x, recompute(x, all));
+        }
+
+        while (!queue_.empty()) {
+            Event event = queue_.top();
+            if (event.time > options_.maxTime) break;
+            queue_.pop();
+            now_ = event.time;
+
+            if (event.kind == ARRIVE) arrive(event.node, event.index);
+            else if (event.kind == PROCESS) process(event.node);
+            else if (event.kind == SEND) send(event.node);
+            else linkEvent(events[event.index]);
+        }
+        converged_ = queue_.empty();
+    }
+
+    bool converged() const { return converged_; }
+    const std::vector<Phase>& phases() const { return phases_; }
+    int infinity() const { return infinity_; }
+    const std::vector<std::vector<int>>& dist() const { return dist_; } // infinity() where unreachable
+    const std::vector<std::vector<int>>& nextHop() const { return nextHop_; }
+
+    // Source-destination pairs whose cost differs from Dijkstra on the current links
+    long countWrongCosts() const {
+        std::vector<Link> links;
+        for (int u = 0; u < n_; ++u) {
+            for (const Neighbor& nb : nodes_[u].neighbors) links.push_back({u, nb.node, nb.cost});
+        }
+        Graph graph = buildGraph(n_, std::move(links));
+        DijkstraScratch s;
+        long wrong = 0;
+        for (int src = 0; src < n_; ++src) {
+            dijkstra(graph, src, s);
+            for (int d = 0; d < n_; ++d) {
+                wrong += (dist_[src][d] < infinity_ ? dist_[src][d] : UNREACHABLE) != s.dist[d];
+            }
+        }
+        return wrong;
+    }
+
+private:
+    enum Kind { ARRIVE, PROCESS, SEND, LINK };
+
+    struct Event {
+        double time;
+        long seq;
+        Kind kind;
+        int node, index; // index: message for ARRIVE, link event for LINK
+        bool operator>(const Event& other) const {
+            return time != other.time ? time > other.time : seq > other.seq;
+        }
+    };
+
+    struct Message {
+        int from = -1;
+        std::vector<std::pair<int, int>> entries; // (destination, cost)
+    };
+
+    struct Neighbor {
+        int node;
+        int cost = INF;     // INF while the link is down
+        double delay = 0;   // From this node to the neighbor
+        std::vector<int> vector; // Last costs the neighbor advertised
+    };
+
+    struct Node {
+        std::vector<Neighbor> neighbors; // Sorted by node, so ties go to the lowest neighbor
+        std::vector<int> inbox;          // Messages waiting to be processed
+        bool scheduled = false;
+        std::vector<int> pending;        // Destinations changed since the last triggered update...
+        std::vector<int> pendingOldHop;  // ...and their next hop as last advertised, NOT_PENDING otherwise
+        double lastSend = -std::numeric_limits<double>::infinity();
+        bool sendScheduled = false;
+    };
+
+    enum { NOT_PENDING = -2 };
+
+    struct Change {
+        int dest, oldHop;
+    };
+
+    Neighbor& neighbor(int x, int node) {
+        std::vector<Neighbor>& list = nodes_[x].neighbors;
+        auto it = std::lower_bound(list.begin(), list.end(), node, [](const Neighbor& nb, int v) { return nb.node < v; });
+        if (it == list.end() || it->node != node) {
+            Neighbor nb;
+            nb.node = node;
+            nb.delay = options_.linkDelay * (1 + options_.jitter * std::uniform_real_distribution<double>(0, 1)(rng_));
+            nb.vector.assign(n_, infinity_);
+            it = list.insert(it, nb);
+        }
+        return *it;
+    }
+
+    void schedule(double time, Kind kind, int node, int index) {
+        queue_.push(Event{time, seq_++, kind, node, index});
+    }
+
+    // Best route to each of dests over the current neighbor vectors; returns the ones that changed
+    std::vector<Change> recompute(int x, const std::vector<int>& dests) {
+        std::vector<Change> changes;
+        for (int d : dests) {
+            if (d == x) continue;
+            int best = infinity_, hop = -1;
+            for (const Neighbor& nb : nodes_[x].neighbors) {
+                if (nb.cost >= INF || nb.vector[d] >= infinity_) continue;
+                int cost = std::min(infinity_, nb.cost + nb.vector[d]);
+                if (cost < best) {
+                    best = cost;
+                    hop = nb.node;
+                }
+            }
+            if (best != dist_[x][d] || hop != nextHop_[x][d]) {
+                changes.push_back({d, nextHop_[x][d]});
+                dist_[x][d] = best;
+                nextHop_[x][d] = hop;
+                ++phases_.back().routeChanges;
+                phases_.back().lastChange = now_;
+            }
+        }
+        return changes;
+    }
+
+    // Send the changed entries to every neighbor whose link is up, or only to node only
+    void advertise(int x, const std::vector<Change>& changes, int only) {
+        if (changes.empty()) return;
+        for (const Neighbor& nb : nodes_[x].neighbors) {
+            if (nb.cost >= INF || (only >= 0 && nb.node != only)) continue;
+
+            int index = allocMessage();
+            Message& msg = messages_[index];
+            msg.from = x;
+            for (const Change& c : changes) {
+                if (c.dest == nb.node) continue; // It knows the way to itself
+                int cost = dist_[x][c.dest];
+                if (nextHop_[x][c.dest] == nb.node && options_.mode != PLAIN) {
+                    if (options_.mode == SPLIT_HORIZON && c.oldHop == nb.node) continue;
+                    cost = infinity_;
+                }
+                msg.entries.push_back({c.dest, cost});
+            }
+            if (msg.entries.empty()) {
+                freeMessages_.push_back(index);
+                continue;
+            }
+
+            Phase& phase = phases_.back();
+            long datagrams = (msg.entries.size() + RIP_MAX_ENTRIES - 1) / RIP_MAX_ENTRIES;
+            phase.datagrams += datagrams;
+            phase.entries += msg.entries.size();
+            phase.bytes += datagrams * RIP_HEADER_BYTES + (long)msg.entries.size() * RIP_ENTRY_BYTES;
+            schedule(now_ + nb.delay, ARRIVE, nb.node, index);
+        }
+    }
+
+    // Hold changes for the next triggered update, which goes out once the update delay has passed
+    void queueChanges(int x, const std::vector<Change>& changes) {
+        Node& node = nodes_[x];
+        if (node.pendingOldHop.empty()) node.pendingOldHop.assign(n_, NOT_PENDING);
+        for (const Change& c : changes) {
+            if (node.pendingOldHop[c.dest] == NOT_PENDING) {
+                node.pendingOldHop[c.dest] = c.oldHop;
+                node.pending.push_back(c.dest);
+            }
+        }
+        if (!node.pending.empty() && !node.sendScheduled) {
+            node.sendScheduled = true;
+            schedule(std::max(now_, node.lastSend + options_.updateDelay), SEND, x, -1);
+        }
+    }
+
+    void send(int x) {
+        Node& node = nodes_[x];
+        std::vector<Change> changes;
+        for (int d : node.pending) {
+            changes.push_back({d, node.pendingOldHop[d]});
+            node.pendingOldHop[d] = NOT_PENDING;
+        }
+        node.pending.clear();
+        node.sendScheduled = false;
+        node.lastSend = now_;
+        advertise(x, changes, -1);
+    }
+
+    // Every finite route of x, as changes, for a neighbor that has just come up
+    std::vector<Change> fullTable(int x) const {
+        std::vector<Change> table;
+        for (int d = 0; d < n_; ++d) {
+            if (d != x && dist_[x][d] < infinity_) table.push_back({d, -1});
+        }
+        return table;
+    }
+
+    void arrive(int x, int index) {
+        Node& node = nodes_[x];
+        node.inbox.push_back(index);
+        if (!node.scheduled) {
+            node.scheduled = true;
+            schedule(now_, PROCESS, x, -1); // After everything else arriving right now
+        }
+    }
+
+    void process(int x) {
+        Node& node = nodes_[x];
+        node.scheduled = false;
+        std::vector<int> dests;
+        marked_.resize(n_, 0);
+
+        for (int index : node.inbox) {
+            Message& msg = messages_[index];
+            Neighbor& nb = neighbor(x, msg.from);
+            if (nb.cost < INF) { // Lost if the link went down on the way
+                for (const std::pair<int, int>& entry : msg.entries) {
+                    nb.vector[entry.first] = entry.second;
+                    if (!marked_[entry.first]) {
+                        marked_[entry.first] = 1;
+                        dests.push_back(entry.first);
+                    }
+                }
+            }
+            msg.entries.clear();
+            freeMessages_.push_back(index);
+        }
+        node.inbox.clear();
+        for (int d : dests) marked_[d] = 0;
+
+        queueChanges(x, recompute(x, dests));
+    }
+
+    void linkEvent(const LinkEvent& event) {
+        std::pair<int, int> key(std::min(event.u, event.v), std::max(event.u, event.v));
+        int cost = event.cost;
+        if (event.kind == LinkEvent::DOWN) {
+            int old = neighbor(event.u, event.v).cost;
+            if (old < INF) downCost_[key] = old;
+            cost = INF;
+        }
+        else if (event.kind == LinkEvent::UP) {
+            auto it = downCost_.find(key);
+            cost = it == downCost_.end() ? neighbor(event.u, event.v).cost : it->second;
+        }
+        if (cost == 0 || cost >= INF) cost = INF;
+
+        Phase phase;
+        phase.label = event.text;
+        phase.start = phase.lastChange = now_;
+        phases_.push_back(phase);
+
+        std::vector<int> all(n_);
+        for (int d = 0; d < n_; ++d) all[d] = d;
+        int ends[2] = {event.u, event.v};
+        bool cameUp[2];
+        for (int i = 0; i < 2; ++i) {
+            Neighbor& nb = neighbor(ends[i], ends[1 - i]);
+            cameUp[i] = nb.cost >= INF && cost < INF;
+            if (nb.cost != cost && (nb.cost >= INF || cost >= INF)) {
+                nb.vector.assign(n_, infinity_); // Nothing learnt over a link survives it going down
+                nb.vector[nb.node] = 0;
+            }
+            nb.cost = cost;
+        }
+        for (int i = 0; i < 2; ++i) {
+            queueChanges(ends[i], recompute(ends[i], all));
+            if (cameUp[i]) advertise(ends[i], fullTable(ends[i]), ends[1 - i]);
+        }
+    }
+
+    int allocMessage() {
+        if (freeMessages_.empty()) {
+            messages_.push_back(Message());
+            return (int)messages_.size() - 1;
+        }
+        int index = freeMessages_.back();
+        freeMessages_.pop_back();
+        return index;
+    }
+
+    int n_;
+    Options options_;
+    std::mt19937 rng_;
+    std::vector<Node> nodes_;
+    std::vector<std::vector<int>> dist_, nextHop_; // Each node's own routing table
+    int maxCost_ = 0;        // Dearest link, in the graph or set by an event
+    int infinity_ = INF;     // Least cost that counts as unreachable
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> queue_;
+    long seq_ = 0;
+    double now_ = 0;
+    std::vector<Message> messages_;
+    std::vector<int> freeMessages_;
+    std::vector<char> marked_;
+    std::map<std::pair<int, int>, int> downCost_;
+    std::vector<Phase> phases_;
+    bool converged_ = false;
+};
+
+#endif // DV_ASYNC_H
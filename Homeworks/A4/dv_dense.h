@@ -0,0 +1,177 @@
+// Dense distance-vector tables relaxed with a vectorized min-plus kernel.
+//
+// A DVR round computes, for every node i and neighbor k, dist[i][j] = min(dist[i][j],
+// cost(i, k) + dist[k][j]) over all destinations j: a min-plus product of the link costs
+// with the distance matrix. The tables are kept as contiguous row-major int arrays, each
+// row padded to a multiple of 16 columns, and one (i, k) pair updates a whole run of
+// columns at once: 8 per AVX2 instruction, 4 per SSE2 one. Unreachable entries hold
+// UNREACHABLE (INT_MAX), and the additions saturate at it, by clamping the neighbor's
+// entry to UNREACHABLE - cost first; UNREACHABLE can never beat an entry, so the kernel
+// needs no checks for it and no branches.
+//
+// A row is relaxed against one neighbor's whole row at a time, so both are read front
+// to back, where the old loop on vector<vector<int>> tables fetched dist[k][j] from a
+// different row for every neighbor k. (Splitting the columns into cache-sized panels was
+// slower: neighbors are scattered, and short runs from scattered rows defeat the
+// prefetcher.) Rows are still relaxed in ascending order and a row sees the rows before
+// it already updated, neighbors in ascending order and only strict improvements, so
+// every round produces exactly the tables the old loop did.
+//
+// The kernel records which neighbor won each improved entry; next hops are filled in
+// from that after the round, in the order the old loop assigned them.
+
+#ifndef DV_DENSE_H
+#define DV_DENSE_H
+
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DV_X86 1
+#endif
+
+#include "graph.h"
+
+// Relax count columns (a multiple of 16) of one row against one neighbor's row:
+// row[j] = min(row[j], cost + neighborRow[j]), setting winner[j] = neighbor where it improves.
+// Returns whether any entry improved.
+typedef bool (*MinPlusKernel)(int* row, int* winner, const int* neighborRow, int cost, int neighbor, int count);
+
+inline bool minPlusScalar(int* row, int* winner, const int* neighborRow, int cost, int neighbor, int count) {
+    bool improved = false;
+    for (int j = 0; j < count; ++j) {
+        int candidate = pathCost(neighborRow[j], cost);
+        if (candidate < row[j]) {
+            row[j] = candidate;
+            winner[j] = neighbor;
+            improved = true;
+        }
+    }
+    return improved;
+}
+
+#ifdef DV_X86
+
+// SSE2 has no 32-bit min, so both the clamp and the min select with a comparison mask
+inline __m128i selectSSE2(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); // mask ? a : b
+}
+
+inline bool minPlusSSE2(int* row, int* winner, const int* neighborRow, int cost, int neighbor, int count) {
+    __m128i c = _mm_set1_epi32(cost), limit = _mm_set1_epi32(UNREACHABLE - cost);
+    __m128i k = _mm_set1_epi32(neighbor), any = _mm_setzero_si128();
+    for (int j = 0; j < count; j += 4) {
+        __m128i cur = _mm_loadu_si128((const __m128i*)(row + j));
+        __m128i next = _mm_loadu_si128((const __m128i*)(neighborRow + j));
+        __m128i candidate = _mm_add_epi32(selectSSE2(_mm_cmpgt_epi32(next, limit), limit, next), c);
+        __m128i better = _mm_cmpgt_epi32(cur, candidate);
+        __m128i win = _mm_loadu_si128((const __m128i*)(winner + j));
+        _mm_storeu_si128((__m128i*)(row + j), selectSSE2(better, candidate, cur));
+        _mm_storeu_si128((__m128i*)(winner + j), selectSSE2(better, k, win));
+        any = _mm_or_si128(any, better);
+    }
+    return _mm_movemask_epi8(any) != 0;
+}
+
+__attribute__((target("avx2")))
+inline bool minPlusAVX2(int* row, int* winner, const int* neighborRow, int cost, int neighbor, int count) {
+    __m256i c = _mm256_set1_epi32(cost), limit = _mm256_set1_epi32(UNREACHABLE - cost);
+    __m256i k = _mm256_set1_epi32(neighbor), any = _mm256_setzero_si256();
+    for (int j = 0; j < count; j += 8) {
+        __m256i cur = _mm256_loadu_si256((const __m256i*)(row + j));
+        __m256i next = _mm256_loadu_si256((const __m256i*)(neighborRow + j));
+        __m256i candidate = _mm256_add_epi32(_mm256_min_epi32(next, limit), c);
+        __m256i better = _mm256_cmpgt_epi32(cur, candidate);
+        __m256i win = _mm256_loadu_si256((const __m256i*)(winner + j));
+        _mm256_storeu_si256((__m256i*)(row + j), _mm256_min_epi32(cur, candidate));
+        _mm256_storeu_si256((__m256i*)(winner + j), _mm256_blendv_epi8(win, k, better));
+        any = _mm256_or_si256(any, better);
+    }
+    return !_mm256_testz_si256(any, any);
+}
+
+#endif // DV_X86
+
+class DenseDV {
+public:
+    enum Kernel { SCALAR, SSE2, AVX2 };
+
+    // The widest kernel this CPU runs
+    static Kernel bestKernel() {
+#ifdef DV_X86
+        if (__builtin_cpu_supports("avx2")) return AVX2;
+        return SSE2;
+#else
+        return SCALAR;
+#endif
+    }
+
+    // Tables as the first DVR round sees them: neighbors at their link cost, the rest UNREACHABLE
+    explicit DenseDV(const Graph& graph, Kernel kernel = bestKernel())
+        : graph_(graph), n_(graph.n), stride_((graph.n + 15) / 16 * 16) {
+        dist_.assign((size_t)n_ * stride_, UNREACHABLE);
+        hop_.assign((size_t)n_ * stride_, -1);
+        winner_.assign((size_t)n_ * stride_, NO_WINNER);
+        for (int i = 0; i < n_; ++i) {
+            dist_[(size_t)i * stride_ + i] = 0;
+            for (int e = graph.begin(i); e < graph.end(i); ++e) {
+                dist_[(size_t)i * stride_ + graph.to[e]] = graph.cost[e];
+                hop_[(size_t)i * stride_ + graph.to[e]] = graph.to[e];
+            }
+        }
+        setKernel(kernel);
+    }
+
+    void setKernel(Kernel kernel) {
+        kernel_ = minPlusScalar;
+#ifdef DV_X86
+        if (kernel == SSE2) kernel_ = minPlusSSE2;
+        if (kernel == AVX2) kernel_ = minPlusAVX2;
+#endif
+    }
+
+    int size() const { return n_; }
+    const int* costRow(int i) const { return dist_.data() + (size_t)i * stride_; }
+    const int* nextHopRow(int i) const { return hop_.data() + (size_t)i * stride_; }
+
+    // One Bellman-Ford round over every node; returns whether any table changed
+    bool relaxRound() {
+        bool updated = false;
+        for (int i = 0; i < n_; ++i) {
+            int* row = dist_.data() + (size_t)i * stride_;
+            int* winner = winner_.data() + (size_t)i * stride_;
+            for (int e = graph_.begin(i); e < graph_.end(i); ++e) {
+                int k = graph_.to[e];
+                updated |= kernel_(row, winner, dist_.data() + (size_t)k * stride_, graph_.cost[e], k, stride_);
+            }
+        }
+        if (updated) assignNextHops();
+        return updated;
+    }
+
+private:
+    enum { NO_WINNER = -1 };
+
+    // Through neighbor k, j's next hop is k's: as updated this round if k < j, since the
+    // old loop went over destinations in ascending order, and as it was before if k > j
+    void assignNextHops() {
+        for (int i = 0; i < n_; ++i) {
+            int* hop = hop_.data() + (size_t)i * stride_;
+            int* winner = winner_.data() + (size_t)i * stride_;
+            for (int j = 0; j < n_; ++j) {
+                if (winner[j] == NO_WINNER) continue;
+                int k = winner[j];
+                hop[j] = (k == j) ? j : hop[k];
+                winner[j] = NO_WINNER;
+            }
+        }
+    }
+
+    const Graph& graph_;
+    int n_, stride_;              // stride_: n rounded up to 16 columns
+    std::vector<int> dist_, hop_; // n x stride_, row-major
+    std::vector<int> winner_;     // Neighbor that improved each entry this round, or NO_WINNER
+    MinPlusKernel kernel_;
+};
+
+#endif // DV_DENSE_H
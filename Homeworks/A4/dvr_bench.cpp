@@ -0,0 +1,108 @@
+// Benchmark for the distance-vector rounds of simulateDVR().
+//
+// Builds random connected topologies (randomGraph() in graph.h) of 512, 1024, ... nodes,
+// and runs DVR on each to convergence, without printing: once with the loop
+// simulateDVR() used to run on vector<vector<int>> tables, then with DenseDV and each
+// min-plus kernel this CPU supports. Every run must produce the same costs and next hops;
+// prints time and speedup for each.
+//
+//   ./dvr_bench [max nodes] [links per node]     e.g. ./dvr_bench 4096 8
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+
+#include "graph.h"
+#include "dv_dense.h"
+
+using namespace std;
+
+// The old simulateDVR() rounds: destinations outer, neighbors inner, on vectors of rows
+int serialDVR(const Graph& graph, vector<vector<int>>& dist, vector<vector<int>>& nextHop) {
+    int n = graph.n;
+    dist.assign(n, vector<int>(n, UNREACHABLE));
+    nextHop.assign(n, vector<int>(n, -1));
+    for (int i = 0; i < n; ++i) {
+        dist[i][i] = 0;
+        for (int e = graph.begin(i); e < graph.end(i); ++e) {
+            dist[i][graph.to[e]] = graph.cost[e];
+            nextHop[i][graph.to[e]] = graph.to[e];
+        }
+    }
+
+    bool updated = true;
+    int rounds = 0;
+    while (updated) {
+        updated = false;
+        ++rounds;
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < n; ++j) {
+                if (i == j || dist[i][j] == 0) continue;
+                for (int e = graph.begin(i); e < graph.end(i); ++e) {
+                    int k = graph.to[e];
+                    if (dist[k][j] == UNREACHABLE) continue;
+                    int newCost = graph.cost[e] + dist[k][j];
+                    if (newCost < dist[i][j]) {
+                        dist[i][j] = newCost;
+                        nextHop[i][j] = (k == j) ? j : nextHop[i][k];
+                        updated = true;
+                    }
+                }
+            }
+        }
+    }
+    return rounds;
+}
+
+bool sameTables(const DenseDV& dv, const vector<vector<int>>& dist, const vector<vector<int>>& nextHop) {
+    for (int i = 0; i < dv.size(); ++i) {
+        for (int j = 0; j < dv.size(); ++j) {
+            if (dv.costRow(i)[j] != dist[i][j] || dv.nextHopRow(i)[j] != nextHop[i][j]) return false;
+        }
+    }
+    return true;
+}
+
+template <typename F>
+double seconds(F&& run) {
+    auto start = chrono::steady_clock::now();
+    run();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    int maxNodes = argc > 1 ? atoi(argv[1]) : 4096;
+    int degree = argc > 2 ? atoi(argv[2]) : 8;
+    maxNodes = max(maxNodes, 2);
+    degree = max(degree, 2);
+
+    static const char* kernelNames[] = {"scalar", "sse2", "avx2"};
+    int best = DenseDV::bestKernel();
+
+    cout << fixed << setprecision(3);
+    cout << "nodes\tlinks\trounds\tkernel\tseconds\tspeedup\n";
+    for (int n = min(512, maxNodes);; n = min(n * 2, maxNodes)) {
+        Graph graph = randomGraph(n, degree);
+        vector<vector<int>> dist, nextHop;
+        int rounds = 0;
+        double base = seconds([&] { rounds = serialDVR(graph, dist, nextHop); });
+        cout << n << "\t" << graph.to.size() / 2 << "\t" << rounds << "\told\t" << base << "\t1.00x\n";
+
+        for (int kernel = DenseDV::SCALAR; kernel <= best; ++kernel) {
+            DenseDV dv(graph, (DenseDV::Kernel)kernel);
+            double t = seconds([&] { while (dv.relaxRound()) {} });
+
+            if (!sameTables(dv, dist, nextHop)) {
+                cerr << "Tables computed with the " << kernelNames[kernel] << " kernel differ from the old loop's\n";
+                return 1;
+            }
+            cout << "\t\t\t" << kernelNames[kernel] << "\t" << t << "\t" << setprecision(2) << base / t << "x"
+                 << setprecision(3) << "\n";
+        }
+        if (n == maxNodes) break;
+    }
+    return 0;
+}
@@ -0,0 +1,358 @@
+// Incremental routing recomputation for link cost changes and failures.
+//
+// DynamicRouting keeps a shortest-path tree (dist and parent per node) for every source
+// and repairs only what a link event invalidates, one direction of the link at a time:
+//
+//   - cheaper link u -> v, or a new one: if it shortens the path to v, Dijkstra restarts
+//     from v alone and only touches the nodes whose distance improves.
+//   - dearer link, or link down: a source is affected only if its tree uses u -> v. The
+//     subtree hanging off v is cut loose, each of its nodes takes the best offer from a
+//     neighbor outside the subtree, and Dijkstra runs over the subtree only.
+//
+// First hops are refreshed for the touched nodes in settle order. Work is counted as
+// nodes settled plus links scanned, against S x (n + links) for running Dijkstra again
+// from all S sources. Costs always match a full recompute; where several paths tie, the
+// next hop may be a different one of them. Sources are repaired in parallel on a ThreadPool.
+//
+// Event scripts have one event per line, '#' starting a comment:
+//
+//   t=5 link 2 3 cost 50     set the cost of link 2-3 (both directions), adding it if missing
+//   t=8 link 1 2 down        remove link 1-2
+//   link 1 2 up              restore link 1-2 at the cost it had before going down
+//
+// Events are applied in order of t (in file order for equal times); an event without t=
+// happens at the time of the one before it.
+
+#ifndef DYNAMIC_ROUTING_H
+#define DYNAMIC_ROUTING_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "graph.h"
+#include "link_state.h"
+#include "thread_pool.h"
+
+struct LinkEvent {
+    double time = 0;
+    int u = 0, v = 0;
+    enum Kind { COST, DOWN, UP } kind = COST;
+    int cost = 0;
+    std::string text; // The line as written, for reports
+};
+
+inline std::vector<LinkEvent> readEventScript(const std::string& filename, int n) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open file " << filename << std::endl;
+        exit(1);
+    }
+
+    std::vector<LinkEvent> events;
+    std::string line;
+    double time = 0;
+    for (int number = 1; std::getline(file, line); ++number) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream iss(line);
+        std::string word, kind, extra;
+        if (!(iss >> word)) continue; // Blank or comment
+
+        LinkEvent event;
+        bool ok = true;
+        if (word.compare(0, 2, "t=") == 0) {
+            char* end;
+            time = strtod(word.c_str() + 2, &end);
+            ok = end != word.c_str() + 2 && *end == '\0';
+            iss >> word;
+        }
+        ok = ok && word == "link" && (iss >> event.u >> event.v >> kind) &&
+             event.u >= 0 && event.u < n && event.v >= 0 && event.v < n && event.u != event.v;
+        if (ok && kind == "cost") ok = (iss >> event.cost) && event.cost >= 0;
+        else if (ok && kind == "down") event.kind = LinkEvent::DOWN;
+        else if (ok && kind == "up") event.kind = LinkEvent::UP;
+        else ok = false;
+
+        if (!ok || (iss >> extra)) {
+            std::cerr << filename << ":" << number << ": expected \"[t=T] link <u> <v> cost <c>|down|up\""
+                      << " with nodes 0.." << n - 1 << std::endl;
+            exit(1);
+        }
+        event.time = time;
+        size_t start = line.find_first_not_of(" \t");
+        size_t end = line.find_last_not_of(" \t\r");
+        event.text = line.substr(start, end - start + 1);
+        events.push_back(event);
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const LinkEvent& a, const LinkEvent& b) {
+        return a.time < b.time;
+    });
+    return events;
+}
+
+// What one event cost, against running Dijkstra again from every source
+struct EventWork {
+    int treesChanged = 0;
+    long work = 0;     // Nodes settled + links scanned
+    long fullWork = 0; // S x (n + links)
+    double seconds = 0;
+};
+
+class DynamicRouting {
+public:
+    DynamicRouting(const Graph& graph, std::vector<int> sources, ThreadPool& pool)
+        : n_(graph.n), sources_(std::move(sources)), pool_(pool), out_(n_), in_(n_), scratch_(pool.size()) {
+        for (int u = 0; u < n_; ++u) {
+            for (int e = graph.begin(u); e < graph.end(u); ++e) {
+                out_[u].push_back({graph.to[e], graph.cost[e]});
+                in_[graph.to[e]].push_back({u, graph.cost[e]});
+            }
+        }
+        for (auto& arcs : in_) std::sort(arcs.begin(), arcs.end());
+        links_ = (long)graph.to.size();
+
+        // Initial trees: one full Dijkstra per source
+        auto start = std::chrono::steady_clock::now();
+        size_t rows = sources_.size() * n_;
+        dist_.assign(rows, UNREACHABLE);
+        parent_.assign(rows, -1);
+        hop_.assign(rows, -1);
+        std::vector<DijkstraScratch> scratch(pool_.size());
+        pool_.parallelFor((int)sources_.size(), [&](int r, int worker) {
+            DijkstraScratch& s = scratch[worker];
+            int src = sources_[r];
+            dijkstra(graph, src, s);
+            int* dist = row(dist_, r);
+            int* parent = row(parent_, r);
+            int* hop = row(hop_, r);
+            for (int v : s.order) {
+                dist[v] = s.dist[v];
+                parent[v] = s.prev[v];
+                if (v != src) hop[v] = (parent[v] == src) ? v : hop[parent[v]];
+            }
+        });
+        fullSeconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    int n() const { return n_; }
+    const std::vector<int>& sources() const { return sources_; }
+    const int* costRow(size_t r) const { return dist_.data() + r * n_; }
+    const int* nextHopRow(size_t r) const { return hop_.data() + r * n_; }
+
+    // Time the initial all-sources computation took, the alternative to each event
+    double fullSeconds() const { return fullSeconds_; }
+
+    EventWork apply(const LinkEvent& event) {
+        auto start = std::chrono::steady_clock::now();
+        int cost = event.cost;
+        if (event.kind == LinkEvent::DOWN) {
+            int old = arcCost(event.u, event.v);
+            if (old < INF) downCost_[std::make_pair(std::min(event.u, event.v), std::max(event.u, event.v))] = old;
+            cost = INF;
+        }
+        else if (event.kind == LinkEvent::UP) {
+            auto it = downCost_.find(std::make_pair(std::min(event.u, event.v), std::max(event.u, event.v)));
+            cost = it == downCost_.end() ? arcCost(event.u, event.v) : it->second;
+        }
+        if (cost == 0 || cost >= INF) cost = INF; // As in the input files, 0 means no link
+
+        EventWork total;
+        std::vector<char> changed(sources_.size(), 0);
+        changeArc(event.u, event.v, cost, total, changed);
+        changeArc(event.v, event.u, cost, total, changed);
+
+        total.treesChanged = (int)std::count(changed.begin(), changed.end(), 1);
+        total.fullWork = (long)sources_.size() * (n_ + links_);
+        total.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return total;
+    }
+
+    // Compare every tree with a Dijkstra run on the current links. False (with a message) on a mismatch.
+    bool verify(std::string& error) const {
+        std::vector<Link> links;
+        for (int u = 0; u < n_; ++u) {
+            for (const Arc& a : out_[u]) links.push_back({u, a.node, a.cost});
+        }
+        Graph graph = buildGraph(n_, std::move(links));
+        DijkstraScratch s;
+        for (size_t r = 0; r < sources_.size(); ++r) {
+            dijkstra(graph, sources_[r], s);
+            const int* dist = costRow(r);
+            const int* parent = parent_.data() + r * n_;
+            for (int v = 0; v < n_; ++v) {
+                bool linked = parent[v] < 0 || dist[v] == pathCost(dist[parent[v]], arcCost(parent[v], v));
+                if (dist[v] != s.dist[v] || !linked) {
+                    std::ostringstream msg;
+                    msg << "source " << sources_[r] << ", node " << v << ": cost " << dist[v]
+                        << ", expected " << s.dist[v];
+                    error = msg.str();
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    struct Arc {
+        int node, cost;
+        bool operator<(const Arc& other) const { return node < other.node; }
+    };
+
+    struct Scratch {
+        std::vector<std::pair<int, int>> heap; // (distance, node) min-heap
+        std::vector<int> subtree, settled;
+        std::vector<char> inSubtree;
+        long work = 0;
+    };
+
+    int* row(std::vector<int>& table, size_t r) { return table.data() + r * n_; }
+
+    int arcCost(int u, int v) const {
+        auto it = std::lower_bound(out_[u].begin(), out_[u].end(), Arc{v, 0});
+        return (it != out_[u].end() && it->node == v) ? it->cost : INF;
+    }
+
+    // Set (or add, or with INF remove) arc u -> v in one adjacency list
+    static void setArc(std::vector<Arc>& arcs, int node, int cost) {
+        auto it = std::lower_bound(arcs.begin(), arcs.end(), Arc{node, 0});
+        bool found = it != arcs.end() && it->node == node;
+        if (cost >= INF) {
+            if (found) arcs.erase(it);
+        }
+        else if (found) it->cost = cost;
+        else arcs.insert(it, Arc{node, cost});
+    }
+
+    void changeArc(int u, int v, int cost, EventWork& total, std::vector<char>& changed) {
+        int old = arcCost(u, v);
+        if (old == cost) return;
+        setArc(out_[u], v, cost);
+        setArc(in_[v], u, cost);
+        links_ += (old >= INF) - (cost >= INF);
+
+        for (Scratch& s : scratch_) s.work = 0;
+        pool_.parallelFor((int)sources_.size(), [&](int r, int worker) {
+            bool touched = cost < old ? decrease(r, u, v, cost, scratch_[worker])
+                                      : increase(r, u, v, scratch_[worker]);
+            if (touched) changed[r] = 1;
+        });
+        for (const Scratch& s : scratch_) total.work += s.work;
+    }
+
+    // u -> v got cheaper (or appeared): restart Dijkstra from v if its path improves
+    bool decrease(size_t r, int u, int v, int cost, Scratch& s) {
+        int* dist = row(dist_, r);
+        int* parent = row(parent_, r);
+        ++s.work;
+        if (dist[u] == UNREACHABLE || pathCost(dist[u], cost) >= dist[v]) return false;
+
+        dist[v] = pathCost(dist[u], cost);
+        parent[v] = u;
+        s.heap.assign(1, {dist[v], v});
+        settle(r, s);
+        return true;
+    }
+
+    // u -> v got dearer (or went down): rebuild the subtree below v if the tree used the link
+    bool increase(size_t r, int u, int v, Scratch& s) {
+        int* dist = row(dist_, r);
+        int* parent = row(parent_, r);
+        int* hop = row(hop_, r);
+        ++s.work;
+        if (parent[v] != u) return false;
+
+        // Cut loose everything whose path ran through u -> v
+        s.inSubtree.resize(n_, 0);
+        s.subtree.assign(1, v);
+        s.inSubtree[v] = 1;
+        for (size_t i = 0; i < s.subtree.size(); ++i) {
+            int x = s.subtree[i];
+            for (const Arc& a : out_[x]) {
+                ++s.work;
+                if (parent[a.node] == x && !s.inSubtree[a.node]) {
+                    s.inSubtree[a.node] = 1;
+                    s.subtree.push_back(a.node);
+                }
+            }
+        }
+        for (int x : s.subtree) {
+            dist[x] = UNREACHABLE;
+            parent[x] = -1;
+            hop[x] = -1;
+        }
+
+        // Best way into the subtree from outside it
+        s.heap.clear();
+        for (int x : s.subtree) {
+            for (const Arc& a : in_[x]) {
+                ++s.work;
+                if (!s.inSubtree[a.node] && pathCost(dist[a.node], a.cost) < dist[x]) {
+                    dist[x] = pathCost(dist[a.node], a.cost);
+                    parent[x] = a.node;
+                }
+            }
+            if (dist[x] < UNREACHABLE) s.heap.push_back({dist[x], x});
+        }
+        std::make_heap(s.heap.begin(), s.heap.end(), std::greater<std::pair<int, int>>());
+        for (int x : s.subtree) s.inSubtree[x] = 0;
+
+        settle(r, s);
+        return true;
+    }
+
+    // Run Dijkstra from the nodes on the heap, then refresh the first hops of what it settled
+    void settle(size_t r, Scratch& s) {
+        int src = sources_[r];
+        int* dist = row(dist_, r);
+        int* parent = row(parent_, r);
+        int* hop = row(hop_, r);
+        std::greater<std::pair<int, int>> later;
+
+        s.settled.clear();
+        while (!s.heap.empty()) {
+            std::pop_heap(s.heap.begin(), s.heap.end(), later);
+            std::pair<int, int> top = s.heap.back();
+            s.heap.pop_back();
+            int x = top.second;
+            if (top.first > dist[x]) continue; // Stale entry
+            s.settled.push_back(x);
+            ++s.work;
+
+            for (const Arc& a : out_[x]) {
+                ++s.work;
+                if (pathCost(dist[x], a.cost) < dist[a.node]) {
+                    dist[a.node] = pathCost(dist[x], a.cost);
+                    parent[a.node] = x;
+                    s.heap.push_back({dist[a.node], a.node});
+                    std::push_heap(s.heap.begin(), s.heap.end(), later);
+                }
+            }
+        }
+
+        // Parents settle first, or lie outside the settled set with their hops unchanged
+        for (int x : s.settled) {
+            hop[x] = (parent[x] == src) ? x : hop[parent[x]];
+        }
+    }
+
+    int n_;
+    std::vector<int> sources_;
+    ThreadPool& pool_;
+    std::vector<std::vector<Arc>> out_, in_; // Current links, both ways, sorted by neighbor
+    long links_ = 0;
+    std::vector<int> dist_, parent_, hop_; // sources x n, row-major
+    std::map<std::pair<int, int>, int> downCost_; // Cost of each link before it went down
+    std::vector<Scratch> scratch_;                 // One per pool thread
+    double fullSeconds_ = 0;
+};
+
+#endif // DYNAMIC_ROUTING_H
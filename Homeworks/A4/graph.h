@@ -0,0 +1,192 @@
+// Sparse network topology for the routing simulator, in compressed sparse row (CSR) form.
+//
+// The links leaving node u are to[offset[u] .. offset[u + 1]), sorted by neighbor, with
+// their costs in cost[] alongside. A topology takes O(n + m) memory instead of an n x n
+// matrix, and the algorithms visit only real neighbors. Neighbors are kept in ascending
+// order so that ties are broken exactly as the matrix scans (v = 0 .. n-1) broke them.
+//
+// readGraphFromFile() accepts two formats, told apart by the first line:
+//
+//   4                  n, then an n x n cost matrix (0 off the diagonal = no link)
+//   0 10 100 30
+//   ...
+//
+//   5 4                n and m, then m links "u v cost" (nodes 0 .. n-1, both directions)
+//   0 1 10
+//   ...
+//
+// As in the matrix, a cost of 0 or of INF and above means "no link", and '#' starts a
+// comment in an edge list. A link listed twice keeps its lower cost.
+//
+// INF only bounds link costs. A path can cost far more than INF, so the algorithms keep
+// distances as ints with UNREACHABLE (INT_MAX) for nodes no path reaches, add link costs
+// with pathCost(), and print INF only for unreachable nodes.
+
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+const int INF = 9999;                // Link costs of INF or more mean "no link"
+const int UNREACHABLE = INT_MAX;     // Distance of a node no path reaches
+
+// dist + cost, saturating at UNREACHABLE
+inline int pathCost(int dist, int cost) {
+    long sum = (long)dist + cost;
+    return sum < UNREACHABLE ? (int)sum : UNREACHABLE;
+}
+
+struct Graph {
+    int n = 0;
+    std::vector<int> offset; // n + 1 entries
+    std::vector<int> to;
+    std::vector<int> cost;
+
+    int begin(int u) const { return offset[u]; }
+    int end(int u) const { return offset[u + 1]; }
+};
+
+struct Link {
+    int from, to, cost;
+    bool operator<(const Link& other) const {
+        if (from != other.from) return from < other.from;
+        if (to != other.to) return to < other.to;
+        return cost < other.cost;
+    }
+};
+
+// Build the CSR arrays from directed links; self-links and "no link" costs are dropped
+inline Graph buildGraph(int n, std::vector<Link> links) {
+    links.erase(std::remove_if(links.begin(), links.end(), [](const Link& l) {
+        return l.from == l.to || l.cost == 0 || l.cost >= INF;
+    }), links.end());
+    std::sort(links.begin(), links.end());
+
+    Graph graph;
+    graph.n = n;
+    graph.offset.assign(n + 1, 0);
+    for (size_t i = 0; i < links.size(); ++i) {
+        if (i > 0 && links[i].from == links[i - 1].from && links[i].to == links[i - 1].to)
+            continue; // Duplicate, the cheaper one came first
+        graph.to.push_back(links[i].to);
+        graph.cost.push_back(links[i].cost);
+        ++graph.offset[links[i].from + 1];
+    }
+    for (int u = 0; u < n; ++u) {
+        graph.offset[u + 1] += graph.offset[u];
+    }
+    return graph;
+}
+
+// Random connected topology for the benchmarks: a random spanning tree plus random extra
+// links up to degree links per node on average, costs 1-20, the same for the same seed
+inline Graph randomGraph(int n, int degree, unsigned seed = 425) {
+    std::mt19937 rng(seed);
+    std::vector<Link> links;
+    auto add = [&](int u, int v) {
+        int cost = std::uniform_int_distribution<int>(1, 20)(rng);
+        links.push_back({u, v, cost});
+        links.push_back({v, u, cost});
+    };
+    for (int v = 1; v < n; ++v) add(std::uniform_int_distribution<int>(0, v - 1)(rng), v);
+    for (long i = n - 1; i < (long)n * degree / 2; ++i) {
+        add(std::uniform_int_distribution<int>(0, n - 1)(rng), std::uniform_int_distribution<int>(0, n - 1)(rng));
+    }
+    return buildGraph(n, std::move(links));
+}
+
+inline Graph readMatrix(std::ifstream& file, const std::string& filename, int n) {
+    std::vector<Link> links;
+    for (int i = 0; i < n; ++i) {
+
+        for (int j = 0; j < n; ++j) {
+
+            int cost;
+
+            if (!(file >> cost)) {
+                std::cerr << "Error: Invalid or missing cost for edge "
+                          << i << "->" << j << " in " << filename << std::endl;
+                exit(1);
+            }
+            links.push_back({i, j, cost});
+        }
+    }
+    return buildGraph(n, std::move(links));
+}
+
+inline Graph readEdgeList(std::ifstream& file, const std::string& filename, int n, long m) {
+    std::vector<Link> links;
+    links.reserve(2 * m);
+
+    std::string line;
+    long count = 0;
+    while (count < m && std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream iss(line);
+        int u, v, cost;
+        if (!(iss >> u)) continue; // Blank or comment
+
+        if (!(iss >> v >> cost) || u < 0 || u >= n || v < 0 || v >= n) {
+            std::cerr << "Error: Invalid link \"" << line << "\" in " << filename << std::endl;
+            exit(1);
+        }
+        links.push_back({u, v, cost});
+        links.push_back({v, u, cost});
+        ++count;
+    }
+    if (count < m) {
+        std::cerr << "Error: Expected " << m << " links in " << filename << ", found " << count << std::endl;
+        exit(1);
+    }
+    return buildGraph(n, std::move(links));
+}
+
+inline Graph readGraphFromFile(const std::string& filename) {
+
+    std::ifstream file(filename);
+
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open file " << filename << std::endl;
+        exit(1);
+    }
+
+    // "n" starts a matrix, "n m" an edge list
+    std::string header;
+    while (std::getline(file, header) && header.find_first_not_of(" \t\r") == std::string::npos) {
+    }
+    std::istringstream iss(header);
+    int n;
+    long m;
+
+    if (!(iss >> n) || n <= 0) {
+        std::cerr << "Error: Invalid node count in " << filename << std::endl;
+        exit(1);
+    }
+    if (!(iss >> m)) return readMatrix(file, filename, n);
+
+    if (m < 0) {
+        std::cerr << "Error: Invalid link count in " << filename << std::endl;
+        exit(1);
+    }
+    return readEdgeList(file, filename, n, m);
+}
+
+inline bool hasNegativeEdges(const Graph& graph) {
+
+    // Critical validation: DVR/LSR algorithms require non-negative weights
+
+    for (int c : graph.cost) {
+        if (c < 0) return true;
+    }
+    return false;
+}
+
+#endif // GRAPH_H
@@ -0,0 +1,109 @@
+// All-sources link-state routing: one Dijkstra run per source, spread over a ThreadPool.
+//
+// Each thread owns a DijkstraScratch (dist, prev, visited, heap and settle order) that is
+// sized once and reset after every run by walking only the nodes the run reached, so a
+// run allocates nothing. The routing tables of a batch of sources go into one store,
+// row r for sources[r] whichever thread computed it, so the printed output is the same
+// for any number of threads.
+
+#ifndef LINK_STATE_H
+#define LINK_STATE_H
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "graph.h"
+#include "thread_pool.h"
+
+struct DijkstraScratch {
+    std::vector<int> dist, prev;
+    std::vector<char> visited;
+    std::vector<int> order; // Nodes in the order they were settled
+    std::vector<std::pair<int, int>> heap; // (distance, node) min-heap
+};
+
+// Shortest paths from src into scratch.dist and scratch.prev (UNREACHABLE and -1 where unreachable)
+inline void dijkstra(const Graph& graph, int src, DijkstraScratch& s) {
+    if ((int)s.dist.size() != graph.n) {
+        s.dist.assign(graph.n, UNREACHABLE);
+        s.prev.assign(graph.n, -1);
+        s.visited.assign(graph.n, 0);
+    }
+    else {
+        for (int v : s.order) {
+            s.dist[v] = UNREACHABLE;
+            s.prev[v] = -1;
+            s.visited[v] = 0;
+        }
+    }
+    s.order.clear();
+    s.heap.clear();
+
+    // Same heap operations as a priority_queue with greater<>, so ties settle in the same order
+    std::greater<std::pair<int, int>> later;
+    s.dist[src] = 0;
+    s.heap.push_back({0, src});
+
+    while (!s.heap.empty()) {
+        std::pop_heap(s.heap.begin(), s.heap.end(), later);
+        int u = s.heap.back().second;
+        s.heap.pop_back();
+
+        if (s.visited[u]) continue;
+        s.visited[u] = 1;
+        s.order.push_back(u);
+
+        for (int e = graph.begin(u); e < graph.end(u); ++e) {
+            int v = graph.to[e];
+            if (!s.visited[v]) {
+                int alt = pathCost(s.dist[u], graph.cost[e]);
+                if (alt < s.dist[v]) {
+                    s.dist[v] = alt;
+                    s.prev[v] = u;
+                    s.heap.push_back({alt, v});
+                    std::push_heap(s.heap.begin(), s.heap.end(), later);
+                }
+            }
+        }
+    }
+}
+
+// Routing tables of a list of sources, row r belonging to sources[r]
+struct RoutingTables {
+    int n = 0;
+    std::vector<int> sources;
+    std::vector<int> cost;    // sources.size() x n, row-major
+    std::vector<int> nextHop; // -1 for the source itself and unreachable nodes
+
+    const int* costRow(size_t r) const { return cost.data() + r * n; }
+    const int* nextHopRow(size_t r) const { return nextHop.data() + r * n; }
+};
+
+// Compute the tables of tables.sources in parallel. scratch holds one entry per pool thread.
+inline void computeLinkState(const Graph& graph, ThreadPool& pool, std::vector<DijkstraScratch>& scratch, RoutingTables& tables) {
+    int n = graph.n;
+    tables.n = n;
+    tables.cost.resize(tables.sources.size() * n);
+    tables.nextHop.resize(tables.sources.size() * n);
+    scratch.resize(pool.size());
+
+    pool.parallelFor((int)tables.sources.size(), [&](int r, int worker) {
+        DijkstraScratch& s = scratch[worker];
+        int src = tables.sources[r];
+        dijkstra(graph, src, s);
+
+        int* cost = tables.cost.data() + (size_t)r * n;
+        int* hop = tables.nextHop.data() + (size_t)r * n;
+        std::copy(s.dist.begin(), s.dist.end(), cost);
+        std::fill(hop, hop + n, -1);
+
+        // A node's predecessor settles first, so its first hop is already known
+        for (int v : s.order) {
+            if (v != src) hop[v] = (s.prev[v] == src) ? v : hop[s.prev[v]];
+        }
+    });
+}
+
+#endif // LINK_STATE_H
@@ -0,0 +1,116 @@
+// Benchmark for the all-sources link-state computation.
+//
+// Builds a random connected topology (randomGraph() in graph.h), or loads one from a
+// file, and computes the routing tables of every source (or of the first S) once the way
+// simulateLSR() used to, one source at a time with fresh buffers, and then with
+// computeLinkState() on pools of 1, 2, 4, ... threads up to the core count. Every run
+// must produce the same tables; prints time and speedup for each.
+//
+//   ./lsr_bench [nodes] [links per node] [sources]     e.g. ./lsr_bench 20000 4 2000
+//   ./lsr_bench --file topology.txt [sources]
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <queue>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <cstdlib>
+
+#include "graph.h"
+#include "link_state.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+// The old simulateLSR(): fresh dist/prev/visited and priority_queue per source, first hops by backtracking
+void serialLinkState(const Graph& graph, RoutingTables& tables) {
+    int n = graph.n;
+    tables.n = n;
+    tables.cost.resize(tables.sources.size() * n);
+    tables.nextHop.resize(tables.sources.size() * n);
+
+    for (size_t r = 0; r < tables.sources.size(); ++r) {
+        int src = tables.sources[r];
+        vector<int> dist(n, UNREACHABLE);
+        vector<int> prev(n, -1);
+        vector<bool> visited(n, false);
+        dist[src] = 0;
+        priority_queue<pair<int, int>, vector<pair<int, int>>, greater<pair<int, int>>> pq;
+        pq.push({0, src});
+
+        while (!pq.empty()) {
+            int u = pq.top().second;
+            pq.pop();
+            if (visited[u]) continue;
+            visited[u] = true;
+            for (int e = graph.begin(u); e < graph.end(u); ++e) {
+                int v = graph.to[e];
+                if (!visited[v] && dist[u] + graph.cost[e] < dist[v]) {
+                    dist[v] = dist[u] + graph.cost[e];
+                    prev[v] = u;
+                    pq.push({dist[v], v});
+                }
+            }
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int hop = i;
+            while (prev[hop] != src && prev[hop] != -1) hop = prev[hop];
+            tables.cost[r * n + i] = dist[i];
+            tables.nextHop[r * n + i] = (i == src || prev[hop] == -1) ? -1 : hop;
+        }
+    }
+}
+
+template <typename F>
+double seconds(F&& run) {
+    auto start = chrono::steady_clock::now();
+    run();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    Graph graph;
+    int sourceCount;
+    if (argc > 2 && string(argv[1]) == "--file") {
+        graph = readGraphFromFile(argv[2]);
+        sourceCount = argc > 3 ? atoi(argv[3]) : graph.n;
+    }
+    else {
+        int n = argc > 1 ? atoi(argv[1]) : 20000;
+        int degree = argc > 2 ? atoi(argv[2]) : 4;
+        graph = randomGraph(max(n, 2), max(degree, 2));
+        sourceCount = argc > 3 ? atoi(argv[3]) : 2000;
+    }
+    sourceCount = max(1, min(sourceCount, graph.n));
+
+    RoutingTables expected;
+    for (int src = 0; src < sourceCount; ++src) expected.sources.push_back(src);
+    double base = seconds([&] { serialLinkState(graph, expected); });
+
+    cout << graph.n << " nodes, " << graph.to.size() / 2 << " links, " << sourceCount << " sources\n";
+    cout << fixed << setprecision(3);
+    cout << "threads\tseconds\tsources/s\tspeedup\n";
+    cout << "old\t" << base << "\t" << setprecision(0) << sourceCount / base << "\t\t1.00x" << setprecision(3) << "\n";
+
+    int cores = max(1u, thread::hardware_concurrency());
+    for (int threads = 1;; threads = min(threads * 2, cores)) {
+        ThreadPool pool(threads);
+        vector<DijkstraScratch> scratch;
+        RoutingTables tables;
+        tables.sources = expected.sources;
+        double t = seconds([&] { computeLinkState(graph, pool, scratch, tables); });
+
+        if (tables.cost != expected.cost || tables.nextHop != expected.nextHop) {
+            cerr << "Tables computed with " << threads << " threads differ from the serial ones\n";
+            return 1;
+        }
+        cout << threads << "\t" << t << "\t" << setprecision(0) << sourceCount / t << "\t\t"
+             << setprecision(2) << base / t << "x" << setprecision(3) << "\n";
+        if (threads == cores) break;
+    }
+    cout << "(" << cores << " cores available)\n";
+    return 0;
+}
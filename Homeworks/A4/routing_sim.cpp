@@ -5,93 +5,63 @@
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <string>
+#include <algorithm>
+#include <thread>
+
+#include "graph.h"
+#include "dv_async.h"
+#include "dv_dense.h"
+#include "dynamic_routing.h"
+#include "link_state.h"
+#include "thread_pool.h"
 
 using namespace std;
 
-const int INF = 9999;
+#define DVR_MAX_NODES 10000             // DVR keeps three n x n tables of ints: 1.2 GB at this size
+#define LSR_BATCH 256                   // LSR tables computed before printing: LSR_BATCH x n costs and next hops
+#define EVENT_MAX_ENTRIES 100000000     // Event mode keeps 3 ints per source and node: 1.2 GB at this size
 
-void printDVRTable(int node, const vector<vector<int>>& table, const vector<vector<int>>& nextHop) {
+// Unreachable destinations (no next hop) print at cost INF, whatever the table holds for them
+void printDVRTable(int node, int n, const int* cost, const int* nextHop) {
     cout << "Node " << node << " Routing Table:\n";
     cout << "Dest\tCost\tNext Hop\n";
-    for (int i = 0; i < table.size(); ++i) {
-        cout << i << "\t" << table[node][i] << "\t";
-        if (nextHop[node][i] == -1) cout << "-";
-        else cout << nextHop[node][i];
-        cout << endl;
+    for (int i = 0; i < n; ++i) {
+        cout << i << "\t" << (nextHop[i] == -1 && i != node ? INF : cost[i]) << "\t";
+        if (nextHop[i] == -1) cout << "-";
+        else cout << nextHop[i];
+        cout << '\n';
     }
     cout << endl;
 }
 
-void simulateDVR(const vector<vector<int>>& graph) {
-    int n = graph.size();
+void simulateDVR(const Graph& graph) {
+    int n = graph.n;
 
-    // 1) Initialize distance and next‑hop tables
+    // 1) Initialize distance and next‑hop tables (contiguous rows, see dv_dense.h)
 
-    vector<vector<int>> dist = graph;
-    vector<vector<int>> nextHop(n, vector<int>(n, -1));
-    for (int i = 0; i < n; ++i) {
-        for (int j = 0; j < n; ++j) {
-            if (i != j && graph[i][j] < INF) {
-                nextHop[i][j] = j;
-            }
-        }
-    }
+    DenseDV dv(graph);
 
     // 2) Print initial tables
 
     cout << "--- Initial DVR Tables ---\n";
     for (int i = 0; i < n; ++i) {
-        printDVRTable(i, dist, nextHop);
+        printDVRTable(i, n, dv.costRow(i), dv.nextHopRow(i));
     }
 
-        // 3) Bellman-Ford algorithm: Relax edges repeatedly until no improvements
-
-        bool updated = true;
-        int iteration = 0;
-        while (updated) {
-            updated = false;
-            ++iteration;
-    
-        // Core DVR logic: Check all possible paths through neighbors
-
-        for (int i = 0; i < n; ++i) { 
-
-            for (int j = 0; j < n; ++j) {  
-
-                if (i==j || dist[i][j] == 0) 
-                    continue;            // Skip self-route
-
-                for (int k = 0; k < n; ++k) {   
-
-                    if (k == i || graph[i][k] == INF)
-                         continue;       // Invalid neighbor
-
-                    if (dist[k][j] == INF)
-                         continue;       // Neighbor has no route to dest   
-
-                    // Bellman-Ford relaxation: i → k → j vs current i → j
-
-                    int newCost = graph[i][k] + dist[k][j];
-
-                    if (newCost < dist[i][j]) {
-                        dist[i][j] = newCost;
+    // 3) Bellman-Ford algorithm: Relax edges repeatedly until no improvements.
+    //    Each round relaxes every node's table through each of its neighbors' tables,
+    //    i → k → j vs current i → j, with the min-plus kernel.
 
-                        // Next hop becomes first hop towards neighbor k
-
-                        nextHop[i][j] = (k == j) ? j : nextHop[i][k];
-                        updated = true;
-                    }
-                }
-            }
-        }
+    int iteration = 0;
+    while (dv.relaxRound()) {
+        ++iteration;
 
         // Only print if something changed this round
 
-        if (updated) {
-            cout << "--- DVR Iteration " << iteration << " ---\n";
-            for (int i = 0; i < n; ++i) {
-                printDVRTable(i, dist, nextHop);
-            }
+        cout << "--- DVR Iteration " << iteration << " ---\n";
+        for (int i = 0; i < n; ++i) {
+            printDVRTable(i, n, dv.costRow(i), dv.nextHopRow(i));
         }
     }
 
@@ -99,162 +69,182 @@ void simulateDVR(const vector<vector<int>>& graph) {
 
     cout << "--- Final DVR Tables ---\n";
     for (int i = 0; i < n; ++i) {
-        printDVRTable(i, dist, nextHop);
+        printDVRTable(i, n, dv.costRow(i), dv.nextHopRow(i));
     }
 }
 
 
-void printLSRTable(int src, const vector<int>& dist, const vector<int>& prev) {
+void printLSRTable(int src, int n, const int* cost, const int* nextHop) {
 
     cout << "Node " << src << " Routing Table:\n";
     cout << "Dest\tCost\tNext Hop\n";
 
-    for (int i = 0; i < dist.size(); ++i) {
+    for (int i = 0; i < n; ++i) {
         
         if (i == src) continue;
-        cout << i << "\t" << dist[i] << "\t";
-        int hop = i;
 
-        // Walk back from destination until we reach a neighbor of src
+        // Next hop is -1 and the cost printed as INF when the destination is unreachable
 
-        while (prev[hop] != src && prev[hop] != -1) {
+        cout << i << "\t" << (nextHop[i] == -1 ? INF : cost[i]) << "\t" << nextHop[i] << '\n';
+    }
+    cout << endl;
+}
 
-            hop = prev[hop];    // Backtrack to find first hop from source
+void simulateLSR(const Graph& graph, const vector<int>& sources, ThreadPool& pool) {
 
-        }
+    // Dijkstra from LSR_BATCH sources at a time across the pool, printed in source order
 
-        // If prev[hop] == -1, destination unreachable
+    vector<DijkstraScratch> scratch;
+    RoutingTables tables;
 
-        cout << (prev[hop] == -1 ? -1 : hop) << endl;
-    }
-    cout << endl;
-}
+    for (size_t first = 0; first < sources.size(); first += LSR_BATCH) {
+        size_t last = min(sources.size(), first + LSR_BATCH);
+        tables.sources.assign(sources.begin() + first, sources.begin() + last);
+        computeLinkState(graph, pool, scratch, tables);
 
-void simulateLSR(const vector<vector<int>>& graph) {
-    int n = graph.size();
-
-    // Run Dijkstra’s algorithm from each node as the source
-    for (int src = 0; src < n; ++src) {
-
-        vector<int> dist(n, INF);
-        vector<int> prev(n, -1);
-        vector<bool> visited(n, false);
-
-        // Distance from src to itself is zero
-        dist[src] = 0;
-
-        // Min-heap (priority queue) storing pairs (distance, node)
-        priority_queue<
-            pair<int, int>,
-            vector<pair<int, int>>,
-            greater<pair<int, int>>
-        > pq;
-        pq.push({0, src});
-
-        while (!pq.empty()) {
-            // Extract node u with the smallest tentative distance
-            int u = pq.top().second;
-            pq.pop();
-
-            // If we've already visited u, skip it
-            if (visited[u]) continue;
-            visited[u] = true;
-
-            // Relax all outgoing edges (u → v)
-            for (int v = 0; v < n; ++v) {
-                if (!visited[v] && graph[u][v] < INF) {
-                    int alt = dist[u] + graph[u][v];
-                    // If going through u gives a shorter path to v, update
-                    if (alt < dist[v]) {
-                        dist[v] = alt;
-                        prev[v] = u;
-                        pq.push({alt, v});
-                    }
-                }
-            }
+        for (size_t r = 0; r < tables.sources.size(); ++r) {
+            printLSRTable(tables.sources[r], graph.n, tables.costRow(r), tables.nextHopRow(r));
         }
-
-        // After Dijkstra finishes for this src, print the routing table
-        printLSRTable(src, dist, prev);
     }
 }
 
 
 
-vector<vector<int>> readGraphFromFile(const string& filename) {
+void simulateEvents(const Graph& graph, const vector<int>& sources, ThreadPool& pool,
+                    const vector<LinkEvent>& events, bool verify) {
 
-    ifstream file(filename);
+    // Build every source's shortest-path tree once, then repair them event by event
 
-    if (!file.is_open()) {
-        cerr << "Error: Could not open file " << filename << endl;
-        exit(1);
-    }
-    
-    int n;
+    DynamicRouting routing(graph, sources, pool);
+    long work = 0, fullWork = 0;
+    double seconds = 0;
 
-    if (!(file >> n) || n <= 0) {
-        cerr << "Error: Invalid node count in " << filename << endl;
-        exit(1);
-    }
+    cout << "Initial tables: " << sources.size() << " sources in " << fixed << setprecision(3)
+         << routing.fullSeconds() * 1000 << " ms\n";
 
-    vector<vector<int>> graph(n, vector<int>(n));
+    for (const LinkEvent& event : events) {
+        EventWork w = routing.apply(event);
+        work += w.work;
+        fullWork += w.fullWork;
+        seconds += w.seconds;
 
-    for (int i = 0; i < n; ++i) {
+        cout << event.text << ": " << w.treesChanged << " of " << sources.size() << " trees changed, work "
+             << w.work << " vs " << w.fullWork << " for a full recompute (" << setprecision(2)
+             << 100.0 * w.work / w.fullWork << "%), " << setprecision(3) << w.seconds * 1000 << " ms\n";
 
-        for (int j = 0; j < n; ++j) {
+        string error;
+        if (verify && !routing.verify(error)) {
+            cerr << "Error: tables differ from a full recompute after \"" << event.text << "\": " << error << "\n";
+            exit(1);
+        }
+    }
+    if (!events.empty()) {
+        cout << "Total: work " << work << " vs " << fullWork << " (" << setprecision(2) << 100.0 * work / fullWork
+             << "%), " << setprecision(3) << seconds * 1000 << " ms vs about "
+             << routing.fullSeconds() * events.size() * 1000 << " ms\n";
+    }
+    if (verify) cout << "Verified against a full recompute after every event\n";
+    cout.unsetf(ios::floatfield);
 
-            int cost;
+    cout << "\n--- Routing Tables After Events ---\n";
+    for (size_t r = 0; r < sources.size(); ++r) {
+        printLSRTable(sources[r], graph.n, routing.costRow(r), routing.nextHopRow(r));
+    }
+}
 
-            if (!(file >> cost)) {
-                cerr << "Error: Invalid or missing cost for edge "
-                     << i << "->" << j << " in " << filename << endl;
-                exit(1);
-            }
+void simulateAsyncDVR(const Graph& graph, const vector<int>& sources, const vector<LinkEvent>& events,
+                      const AsyncDVSimulator::Options& options) {
 
-            // Off‐diagonal zeros mean “no link”
+    // Nodes exchange vectors with their neighbors only, through a discrete-event scheduler
 
-            if (i != j && cost == 0) {
-                graph[i][j] = INF;
-            } else {
-                graph[i][j] = cost;
-            }
-        }
-    }
-    file.close();
+    static const char* modeNames[] = {"plain", "split horizon", "poison reverse"};
+    cout << "Mode: " << modeNames[options.mode] << ", link delay " << options.linkDelay
+         << " (+ up to " << options.jitter * 100 << "%), update delay " << options.updateDelay << "\n";
 
-    // Guarantee self‐distance is zero
+    AsyncDVSimulator sim(graph, options);
+    sim.run(events);
 
-    for (int i = 0; i < n; ++i) {
-        graph[i][i] = 0;
+    AsyncDVSimulator::Phase total;
+    for (const AsyncDVSimulator::Phase& phase : sim.phases()) {
+        cout << phase.label << ": converged " << phase.lastChange - phase.start << " after it (t="
+             << phase.lastChange << "), " << phase.routeChanges << " route changes, " << phase.datagrams
+             << " datagrams, " << phase.entries << " entries, " << phase.bytes << " bytes\n";
+        total.routeChanges += phase.routeChanges;
+        total.datagrams += phase.datagrams;
+        total.entries += phase.entries;
+        total.bytes += phase.bytes;
     }
+    cout << "Total: " << total.routeChanges << " route changes, " << total.datagrams << " datagrams, "
+         << total.entries << " entries, " << total.bytes << " bytes\n";
+    if (!sim.converged()) cout << "Stopped at t=" << options.maxTime << " before converging\n";
 
-    return graph;
-}
+    long wrong = sim.countWrongCosts();
+    if (wrong == 0) cout << "Costs match link state for all " << (long)graph.n * graph.n << " pairs\n";
+    else cout << wrong << " of " << (long)graph.n * graph.n << " costs differ from link state\n";
 
+    cout << "\n--- Final DVR Tables ---\n";
+    for (int node : sources) {
+        printDVRTable(node, graph.n, sim.dist()[node].data(), sim.nextHop()[node].data());
+    }
+}
 
-bool hasNegativeEdges(const vector<vector<int>>& graph) {
-
-    // Critical validation: DVR/LSR algorithms require non-negative weights
-
-    for (int i = 0; i < graph.size(); ++i) {
-      for (int j = 0; j < graph.size(); ++j) {
-        if (i != j && graph[i][j] < 0 && graph[i][j] != INF)
-          return true;
-      }
+// "0,5,9" -> {0, 5, 9}; an empty list means every node
+vector<int> parseSources(const string& list, int n) {
+    vector<int> sources;
+    stringstream ss(list);
+    string item;
+    while (getline(ss, item, ',')) {
+        char* end;
+        long src = strtol(item.c_str(), &end, 10);
+        if (item.empty() || *end != '\0' || src < 0 || src >= n) {
+            cerr << "Error: Invalid source node \"" << item << "\" (nodes are 0.." << n - 1 << ")\n";
+            exit(1);
+        }
+        sources.push_back((int)src);
+    }
+    if (sources.empty()) {
+        for (int i = 0; i < n; ++i) sources.push_back(i);
     }
-    return false;
+    return sources;
 }
-  
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " <input_file>\n";
+    string filename, algo = "both", sourceList, eventFile;
+    int threads = max(1u, thread::hardware_concurrency());
+    bool usage = false, verify = false;
+    AsyncDVSimulator::Options dvOptions;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--algo" && i + 1 < argc) algo = argv[++i];
+        else if (arg == "--sources" && i + 1 < argc) sourceList = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (arg == "--events" && i + 1 < argc) eventFile = argv[++i];
+        else if (arg == "--verify") verify = true;
+        else if (arg == "--dv-mode" && i + 1 < argc) {
+            string mode = argv[++i];
+            if (mode == "plain") dvOptions.mode = AsyncDVSimulator::PLAIN;
+            else if (mode == "split-horizon") dvOptions.mode = AsyncDVSimulator::SPLIT_HORIZON;
+            else if (mode == "poison-reverse") dvOptions.mode = AsyncDVSimulator::POISON_REVERSE;
+            else usage = true;
+        }
+        else if (arg == "--link-delay" && i + 1 < argc) dvOptions.linkDelay = atof(argv[++i]);
+        else if (arg == "--jitter" && i + 1 < argc) dvOptions.jitter = atof(argv[++i]);
+        else if (arg == "--update-delay" && i + 1 < argc) dvOptions.updateDelay = atof(argv[++i]);
+        else if (arg == "--max-time" && i + 1 < argc) dvOptions.maxTime = atof(argv[++i]);
+        else if (filename.empty() && arg.compare(0, 2, "--") != 0) filename = arg;
+        else usage = true;
+    }
+    bool knownAlgo = algo == "dvr" || algo == "lsr" || algo == "both" || algo == "dv-async";
+    if (usage || filename.empty() || threads < 1 || !knownAlgo || dvOptions.linkDelay < 0 || dvOptions.jitter < 0 ||
+        dvOptions.updateDelay < 0) {
+        cerr << "Usage: " << argv[0] << " [--algo dvr|lsr|both|dv-async] [--sources 0,1,...] [--threads N]\n"
+             << "       [--events FILE [--verify]] [--dv-mode plain|split-horizon|poison-reverse]\n"
+             << "       [--link-delay D] [--jitter J] [--update-delay U] [--max-time T] <input_file>\n";
         return 1;
     }
 
-    string filename = argv[1];
-
-    vector<vector<int>> graph = readGraphFromFile(filename);
+    Graph graph = readGraphFromFile(filename);
 
     // Fail on negative weights - violates algorithm assumptions
 
@@ -262,12 +252,46 @@ int main(int argc, char *argv[]) {
         cerr << "ERROR : negative edge cost detected; all link metrics must be non‑negative.\n";
         return 1;
     }
-      
-    cout << "\n--- Distance Vector Routing Simulation ---\n";
-    simulateDVR(graph);
 
-    cout << "\n--- Link State Routing Simulation ---\n";
-    simulateLSR(graph);
+    vector<int> sources = parseSources(sourceList, graph.n);
+
+    bool dvTables = algo == "dv-async" || (eventFile.empty() && algo != "lsr");
+    if (dvTables && graph.n > DVR_MAX_NODES) {
+        cerr << "Error: DVR keeps n x n tables and is limited to " << DVR_MAX_NODES << " nodes ("
+             << graph.n << " given); use --algo lsr\n";
+        return 1;
+    }
+
+    if (algo == "dv-async") {
+        vector<LinkEvent> events;
+        if (!eventFile.empty()) events = readEventScript(eventFile, graph.n);
+        cout << "\n--- Asynchronous Distance Vector Simulation ---\n";
+        simulateAsyncDVR(graph, sources, events, dvOptions);
+        return 0;
+    }
+
+    if (!eventFile.empty()) {
+        if ((double)sources.size() * graph.n > EVENT_MAX_ENTRIES) {
+            cerr << "Error: " << sources.size() << " trees of " << graph.n << " nodes are too many to keep; use --sources\n";
+            return 1;
+        }
+        vector<LinkEvent> events = readEventScript(eventFile, graph.n);
+        ThreadPool pool(threads);
+        cout << "\n--- Link Event Simulation ---\n";
+        simulateEvents(graph, sources, pool, events, verify);
+        return 0;
+    }
+
+    if (algo != "lsr") {
+        cout << "\n--- Distance Vector Routing Simulation ---\n";
+        simulateDVR(graph);
+    }
+
+    if (algo != "dvr") {
+        cout << "\n--- Link State Routing Simulation ---\n";
+        ThreadPool pool(threads);
+        simulateLSR(graph, sources, pool);
+    }
 
     return 0;
 }
@@ -0,0 +1,94 @@
+// Fixed pool of worker threads for the routing simulator.
+//
+// parallelFor(count, fn) calls fn(index, worker) for every index in 0 .. count-1 and
+// returns once all calls are done. Indices are handed out one at a time from an atomic
+// counter, so sources with large and small shortest-path trees balance themselves out.
+// worker (0 .. size()-1) names the calling thread, so callers can keep one scratch buffer
+// per thread; the thread calling parallelFor() takes part as worker 0.
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads) {
+        for (int worker = 1; worker < std::max(threads, 1); ++worker) {
+            workers_.emplace_back([this, worker] { workerLoop(worker); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+        start_.notify_all();
+        for (std::thread& t : workers_) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return (int)workers_.size() + 1; }
+
+    void parallelFor(int count, const std::function<void(int, int)>& fn) {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            job_ = &fn;
+            count_ = count;
+            next_ = 0;
+            busy_ = (int)workers_.size();
+            ++generation_;
+        }
+        start_.notify_all();
+        work(0);
+
+        std::unique_lock<std::mutex> lock(mtx_);
+        done_.wait(lock, [this] { return busy_ == 0; });
+        job_ = nullptr;
+    }
+
+private:
+    void work(int worker) {
+        for (int index; (index = next_.fetch_add(1, std::memory_order_relaxed)) < count_;) {
+            (*job_)(index, worker);
+        }
+    }
+
+    void workerLoop(int worker) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                start_.wait(lock, [&] { return stop_ || generation_ != seen; });
+                if (stop_) return;
+                seen = generation_;
+            }
+            work(worker);
+
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (--busy_ == 0) done_.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mtx_;
+    std::condition_variable start_, done_;
+    const std::function<void(int, int)>* job_ = nullptr; // Under mtx_ while set, read by work()
+    int count_ = 0;
+    std::atomic<int> next_{0};
+    int busy_ = 0;            // Workers still inside the current parallelFor()
+    uint64_t generation_ = 0; // Bumped by each parallelFor()
+    bool stop_ = false;
+};
+
+#endif // THREAD_POOL_H